@@ -35,4 +35,18 @@
 xcb_atom_t
 xcwm_atom_register(xcwm_context_t *context, const char *atom, xcwm_event_type_t event);
 
+/**
+ * register interest in a list of atoms, interning them all with a
+ * single round trip
+ * @param context The context
+ * @param atoms The names of the atoms
+ * @param events The event to be delivered when each atom changes
+ * @param count The number of atoms
+ * @param atoms_return If not NULL, set to the atoms
+ */
+void
+xcwm_atom_register_list(xcwm_context_t *context, const char **atoms,
+                        const xcwm_event_type_t *events, int count,
+                        xcb_atom_t *atoms_return);
+
 #endif /* XCWM_ATOMS_H */
@@ -41,6 +41,34 @@ typedef struct xcwm_window_t xcwm_window_t;
 struct xcwm_context_t;
 typedef struct xcwm_context_t xcwm_context_t;
 
+/**
+ * Counters describing the work done on a context.
+ */
+struct xcwm_context_stats_t {
+    unsigned long batches;           /* Event batches delivered */
+    unsigned long batch_events;      /* Raw events in all batches */
+    unsigned long last_batch_events; /* Raw events in the last batch */
+    unsigned long last_batch_merged; /* Of those, how many were merged */
+    unsigned long damage_merged;     /* DamageNotify events merged */
+    unsigned long property_merged;   /* PropertyNotify events merged */
+    unsigned long configure_merged;  /* ConfigureNotify events merged */
+    unsigned long property_suppressed; /* PropertyNotify events not
+                                        * delivered as an event of their
+                                        * own */
+    unsigned long pixmap_named;      /* Composite pixmaps named */
+    unsigned long pixmap_reused;     /* Composite pixmaps kept across a
+                                      * ConfigureNotify */
+    unsigned long flushes;           /* Requests written to the server */
+    unsigned long flushes_deferred;  /* Writes saved by batching requests */
+    unsigned long errors;            /* X errors received */
+    unsigned long ring_overruns;     /* Events lost as the ring was full */
+    unsigned long redraws_saved;     /* Damage events held for the next
+                                      * frame, see
+                                      * xcwm_event_set_frame_interval()
+                                      * and xcwm_window_set_max_fps() */
+};
+typedef struct xcwm_context_stats_t xcwm_context_stats_t;
+
 /**
  * Sets up the connection and grabs the root window from the specified screen
  * @param display the display to connect to
@@ -51,7 +79,9 @@ xcwm_context_open (char *display);
 
 /**
  * Closes the windows open on the X Server, the connection, and the event
- * loop.
+ * loop. The event loop is stopped first, waiting for any event being
+ * processed, so this must not be called from the context's own event
+ * callback.
  * @param context The context to close.
  */
 void
@@ -73,4 +103,74 @@ xcwm_context_get_root_window(xcwm_context_t const *context);
 xcb_connection_t *
 xcwm_context_get_connection(xcwm_context_t const *context);
 
+/**
+ * Get the current counters for this context. The counters are updated
+ * by the event loop without locking, so may be slightly stale.
+ * @param context The context to get counters for.
+ * @param[out] stats The structure to fill in with the counters.
+ */
+void
+xcwm_context_get_stats(xcwm_context_t const *context,
+                       xcwm_context_stats_t *stats);
+
+/**
+ * Start a batch of requests. Until the matching xcwm_context_commit(),
+ * functions called on this thread which would send their request to
+ * the server immediately only queue it, so changing many windows costs
+ * a single write. Requests from other threads, such as the event
+ * thread, are still sent. Batches may be nested.
+ * @param context The context to batch requests on.
+ */
+void
+xcwm_context_begin_batch(xcwm_context_t *context);
+
+/**
+ * End a batch of requests started by xcwm_context_begin_batch() on the
+ * same thread. When the outermost batch ends, everything queued is sent
+ * to the server.
+ * @param context The context to send the requests on.
+ */
+void
+xcwm_context_commit(xcwm_context_t *context);
+
+/**
+ * Get the file descriptor of the connection for this context, for
+ * clients running their own main loop instead of
+ * xcwm_event_start_loop(). When it becomes readable, call
+ * xcwm_context_dispatch(). Events can also be read from the connection
+ * while waiting for replies, so call xcwm_context_dispatch() before
+ * each wait on the descriptor as well.
+ * @param context The context to get the file descriptor for.
+ * @return The file descriptor of the context's connection.
+ */
+int
+xcwm_context_get_fd(xcwm_context_t const *context);
+
+/**
+ * Get how long a client running its own main loop may wait on the
+ * file descriptor before calling xcwm_context_dispatch() again, so
+ * damage held back by frame pacing is delivered on time.
+ * @param context The context.
+ * @return The timeout in milliseconds, suitable for poll(), or -1 if
+ * there is no need to call before the descriptor becomes readable.
+ */
+int
+xcwm_context_get_timeout(xcwm_context_t *context);
+
+/**
+ * Process the events pending on the context's connection on the
+ * calling thread, delivering them to the callback set with
+ * xcwm_event_set_callback(). Never blocks. As events are handled on
+ * the caller's thread, there is no need to take the event loop thread
+ * lock. Must not be mixed with xcwm_event_start_loop() or
+ * xcwm_event_start_shared_loop() on the same context.
+ * @param context The context to process events for.
+ * @param max_events The maximum number of events to process, or 0 to
+ * process all pending events.
+ * @return The number of events processed, -1 if the connection has an
+ * error.
+ */
+int
+xcwm_context_dispatch(xcwm_context_t *context, int max_events);
+
 #endif  /* _XCWM_CONTEXT_H_ */
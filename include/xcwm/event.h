@@ -36,6 +36,27 @@ typedef struct xcwm_event_t xcwm_event_t;
 
 typedef void (*xcwm_event_cb_t)(xcwm_event_t const *event);
 
+/* Operations whose failure is reported to the error callback */
+typedef enum xcwm_error_op_t {
+    XCWM_ERROR_OP_UNKNOWN = 0,  /* Not a request libxcwm keeps track of */
+    XCWM_ERROR_OP_DAMAGE_CREATE,
+    XCWM_ERROR_OP_DAMAGE_SUBTRACT,
+    XCWM_ERROR_OP_SHAPE_SELECT,
+} xcwm_error_op_t;
+
+/**
+ * Function called when the server reports an error.
+ * @param context The context the error was received on.
+ * @param window The window the failed request was made for, NULL if
+ * unknown or no longer managed.
+ * @param op The operation which failed.
+ * @param error_code The X error code.
+ */
+typedef void (*xcwm_error_cb_t)(xcwm_context_t *context,
+                                xcwm_window_t *window,
+                                xcwm_error_op_t op,
+                                uint8_t error_code);
+
 /* Event types */
 typedef enum xcwm_event_type_t {
     XCWM_EVENT_WINDOW_DAMAGE = 0,
@@ -48,6 +69,20 @@ typedef enum xcwm_event_type_t {
     XCWM_EVENT_CURSOR,
 } xcwm_event_type_t;
 
+/**
+ * An event as delivered through the event ring. Records are copies,
+ * so remain valid whatever happens to the window afterwards. A record
+ * with a window holds a reference to it, which the consumer must drop
+ * with xcwm_window_unref() once done with the record.
+ */
+typedef struct xcwm_event_record_t {
+    xcwm_window_t *window;      /* Window of the event, NULL if none */
+    xcb_window_t window_id;     /* Its ID, XCB_NONE if none */
+    xcwm_event_type_t event_type;
+    xcwm_rect_t damage;         /* Bounding box of the window's damage */
+    xcwm_rect_t bounds;         /* Geometry of the window */
+} xcwm_event_record_t;
+
 /**
  *  Return the event type for the given event.
  */
@@ -77,18 +112,135 @@ int
 xcwm_event_start_loop(xcwm_context_t *context, xcwm_event_cb_t callback);
 
 /**
- * Request a lock on the mutex for the event loop thread. Blocks
- * until lock is aquired, or error occurs.
+ * Like xcwm_event_start_loop(), but instead of starting a thread for
+ * this context, the context is serviced by a single event loop thread
+ * shared by every context started this way. The shared thread waits
+ * on the connections of all of its contexts at once, so watching many
+ * displays does not cost one thread per display.
+ * The shared thread doesn't hold any lock while calling the callback,
+ * so the callback may start and close other contexts.
+ * xcwm_context_close() removes the context from the shared loop,
+ * waiting for the shared thread to finish with it; it must not be
+ * called from within the context's own callback.
+ * @param context The context containing the connection to listen
+ * for events on.
+ * @param callback The function to call when an event of interest is
+ * received.
+ * @return 0 on success, otherwise non-zero
+ */
+int
+xcwm_event_start_shared_loop(xcwm_context_t *context,
+                             xcwm_event_cb_t callback);
+
+/**
+ * Set the function to call when an event of interest is received by
+ * xcwm_context_dispatch(). Callback must be able to take an
+ * xcwm_event_t as its one and only parameter.
+ * @param context The context to set the callback for.
+ * @param callback The function to call when an event of interest is
+ * received.
+ */
+void
+xcwm_event_set_callback(xcwm_context_t *context, xcwm_event_cb_t callback);
+
+/**
+ * Set the function to call when the server reports an error. Requests
+ * are not checked as they are made, so errors are reported
+ * asynchronously by the event loop, with the window and operation of
+ * the request which failed. Without a callback, errors are written to
+ * stderr.
+ * @param context The context to set the callback for.
+ * @param callback The function to call, or NULL.
+ */
+void
+xcwm_event_set_error_callback(xcwm_context_t *context,
+                              xcwm_error_cb_t callback);
+
+/**
+ * Deliver events through a ring of records instead of the event
+ * callback. The event loop thread adds a record to the ring for each
+ * event, and the client takes them with xcwm_event_ring_pop() on any
+ * one thread of its own, without taking the event loop thread lock.
+ * The event callback is then not called. Must be called before the
+ * event loop is started.
+ * @param context The context to deliver events for.
+ * @param size The number of records the ring holds, rounded up to a
+ * power of two, or 0 to deliver events to the callback.
+ * @return 0 on success, otherwise non-zero.
+ */
+int
+xcwm_event_set_ring(xcwm_context_t *context, unsigned int size);
+
+/**
+ * Take the oldest record from the event ring. Must only be called from
+ * one thread at a time. The reference to the record's window, if it
+ * has one, passes to the caller.
+ * @param context The context to take an event for.
+ * @param[out] record The record taken.
+ * @return 1 if a record was taken, 0 if the ring is empty.
+ */
+int
+xcwm_event_ring_pop(xcwm_context_t *context, xcwm_event_record_t *record);
+
+/**
+ * Get the number of events lost because the event ring was full. When
+ * full, new events are dropped, the records already in the ring are
+ * kept.
+ * @param context The context to get the count for.
+ * @return The number of events lost.
+ */
+unsigned long
+xcwm_event_ring_get_overruns(xcwm_context_t const *context);
+
+/**
+ * Enable or disable batching of events. When enabled, the event loop
+ * drains every event already received before delivering any, merging
+ * damage to the same window, changes to the same property of a window
+ * and reconfiguration of the same window. One event is then delivered
+ * per window per kind of change, at the end of the batch.
+ * Batching is disabled by default. See xcwm_context_get_stats() for
+ * counts of the events merged.
+ * @param context The context to set batching for.
+ * @param enable Non-zero to enable batching, zero to disable.
+ */
+void
+xcwm_event_set_batching(xcwm_context_t *context, int enable);
+
+/**
+ * Pace the delivery of damage events. Damage is accumulated and
+ * delivered at most once per interval, however often the server
+ * reports it, so the client doesn't redraw more often than it can
+ * show frames. Other events are still delivered as soon as they are
+ * received. Clients using xcwm_context_dispatch() should wait no
+ * longer than xcwm_context_get_timeout() between calls. See
+ * xcwm_context_get_stats() for the number of redraws saved.
+ * @param context The context to pace damage for.
+ * @param interval_us The shortest time between damage deliveries in
+ * microseconds, e.g. 16667 for 60 frames a second, or 0 to deliver
+ * damage as soon as it is received.
+ */
+void
+xcwm_event_set_frame_interval(xcwm_context_t *context,
+                              unsigned long interval_us);
+
+/**
+ * Request a lock on the mutex for the event loop thread of the given
+ * context. Blocks until lock is aquired, or error occurs. The event
+ * loop doesn't take this lock itself, use xcwm_window_lock() to
+ * protect the damage and geometry of a window.
+ * @param context The context whose event loop should be locked.
  * @return 0 if successful, otherwise non-zero
  */
 int
-xcwm_event_get_thread_lock(void);
+xcwm_event_get_thread_lock(xcwm_context_t *context);
 
 /**
- * Release the lock on the mutex for the event loop thread.
+ * Release the lock on the mutex for the event loop thread of the
+ * given context.
+ * @param context The context whose event loop should be unlocked.
  * @return 0 if successsful, otherwise non-zero
  */
 int
-xcwm_event_release_thread_lock(void);
+xcwm_event_release_thread_lock(xcwm_context_t *context);
 
 #endif /* _XCWM_EVENT_H_ */
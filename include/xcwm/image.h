@@ -63,6 +63,59 @@ xcwm_image_copy_full (xcwm_window_t *window);
 xcwm_image_t *
 xcwm_image_copy_damaged(xcwm_window_t *window);
 
+/**
+ * Returns the given area of the window's image, for example one of
+ * the rectangles returned by xcwm_window_get_damaged_rects(). The
+ * area is noted as copied, for xcwm_window_remove_damage().
+ * @param window The window to get image from
+ * @param area The area of the window to copy
+ * @return an xcwm_image_t with partial image window contents or
+ * NULL if the area has zero width or height
+ */
+xcwm_image_t *
+xcwm_image_copy_area(xcwm_window_t *window, xcwm_rect_t const *area);
+
+/**
+ * A request for an image which has been sent, but whose image has not
+ * yet been collected
+ */
+typedef struct xcwm_image_request_t xcwm_image_request_t;
+
+/**
+ * Send a request for the damaged portion of the window's image,
+ * without waiting for it. Requests for several windows can be sent
+ * before collecting any of them, so their replies are waited for
+ * together rather than one after another.
+ * @param window The window to get image from
+ * @return The request, to be passed to xcwm_image_collect(), or NULL
+ * if the damaged area has zero width or height. The request holds a
+ * reference to the window, so may be collected even after the window
+ * has been destroyed.
+ */
+xcwm_image_request_t *
+xcwm_image_request_damaged(xcwm_window_t *window);
+
+/**
+ * Send a request for the given area of the window's image, without
+ * waiting for it, as xcwm_image_request_damaged() does.
+ * @param window The window to get image from
+ * @param area The area of the window to copy
+ * @return The request, to be passed to xcwm_image_collect(), or NULL
+ * if the area has zero width or height
+ */
+xcwm_image_request_t *
+xcwm_image_request_area(xcwm_window_t *window, xcwm_rect_t const *area);
+
+/**
+ * Wait for the image of a request, and free the request. The area is
+ * noted as copied, as for xcwm_image_copy_area().
+ * @param request The request
+ * @return an xcwm_image_t with the requested contents, or NULL if the
+ * request failed
+ */
+xcwm_image_t *
+xcwm_image_collect(xcwm_image_request_t *request);
+
 /**
  * Free the memory used by an xcwm_image_t created
  * during a call to xcwm_image_get_*.
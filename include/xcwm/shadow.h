@@ -0,0 +1,107 @@
+/* Copyright (c) 2013 The libxcwm authors
+ *
+ * xcwm/shadow.h
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _XCWM_SHADOW_H_
+#define _XCWM_SHADOW_H_
+
+
+#ifndef __XCWM_INDIRECT__
+#error "Please #include <xcwm/xcwm.h> instead of this file directly."
+#endif
+
+#include <stdint.h>
+
+/**
+ * A copy of a window's contents kept by libxcwm, which is updated
+ * from the window's damage
+ */
+struct xcwm_shadow_t {
+    uint8_t *data;      /* The pixels, changed only by xcwm_shadow_update */
+    int width;
+    int height;
+    int stride;         /* Bytes from one row to the next */
+    int bpp;            /* Bits per pixel */
+    int depth;
+    unsigned long generation; /* Incremented by each update changing it */
+};
+typedef struct xcwm_shadow_t xcwm_shadow_t;
+
+/**
+ * Keep a shadow buffer for the window. Its contents are read in full
+ * at the next xcwm_shadow_update().
+ * @param window The window
+ */
+void
+xcwm_shadow_enable(xcwm_window_t *window);
+
+/**
+ * Stop keeping a shadow buffer for the window, and free it. An update
+ * already in progress on another thread is waited for, but no other
+ * shadow function may be called for the window once this has started.
+ * @param window The window
+ */
+void
+xcwm_shadow_disable(xcwm_window_t *window);
+
+/**
+ * Copy the damaged areas of the window into its shadow buffer, and
+ * remove the damage, as xcwm_window_remove_damage() does. The whole
+ * window is read again if its size has changed, in which case the
+ * data pointer may change. The window is only locked to take note of
+ * its damage and of what was read, not while reading, so the event
+ * loop isn't held up; damage reported meanwhile is left for the next
+ * update.
+ * @param window The window
+ * @return The generation of the shadow buffer after the update, 0 if
+ * the window has no shadow buffer.
+ */
+unsigned long
+xcwm_shadow_update(xcwm_window_t *window);
+
+/**
+ * Get the window's shadow buffer.
+ * @param window The window
+ * @return The shadow buffer, or NULL if it isn't enabled. The data
+ * pointer is NULL until the first update.
+ */
+xcwm_shadow_t const *
+xcwm_shadow_get(xcwm_window_t const *window);
+
+/**
+ * Get the areas of the shadow buffer changed by updates since the
+ * given generation. If that generation is too old to be known, the
+ * whole buffer is returned.
+ * @param window The window
+ * @param generation The generation the client last saw
+ * @param count Set to the number of rectangles returned
+ * @return The rectangles, valid until the next call.
+ */
+xcwm_rect_t const *
+xcwm_shadow_get_dirty_rects(xcwm_window_t *window,
+                            unsigned long generation, int *count);
+
+
+#endif  /* _XCWM_SHADOW_H_ */
@@ -0,0 +1,90 @@
+/* Copyright (c) 2013 The libxcwm authors
+ *
+ * xcwm/snapshot.h
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _XCWM_SNAPSHOT_H_
+#define _XCWM_SNAPSHOT_H_
+
+
+#ifndef __XCWM_INDIRECT__
+#error "Please #include <xcwm/xcwm.h> instead of this file directly."
+#endif
+
+/**
+ * The state of one window in a snapshot
+ */
+struct xcwm_snapshot_window_t {
+    xcb_window_t window_id;
+    xcwm_window_type_t type;
+    int override_redirect;
+    unsigned int opacity;
+    xcwm_rect_t bounds;
+    xcwm_rect_t damage;         /* Bounding box of the damage */
+};
+typedef struct xcwm_snapshot_window_t xcwm_snapshot_window_t;
+
+/**
+ * The state of all the windows of a context at one moment. A snapshot
+ * never changes once made, so can be read without any lock for as long
+ * as a reference to it is held.
+ */
+struct xcwm_snapshot_t {
+    unsigned long generation;   /* Incremented for each new snapshot */
+    int num_windows;
+    xcwm_snapshot_window_t const *windows; /* In stacking order, bottom
+                                         * first */
+};
+typedef struct xcwm_snapshot_t xcwm_snapshot_t;
+
+/**
+ * Get the latest snapshot of the windows of a context. The event loop
+ * makes a new snapshot once it has processed the events available, if
+ * they changed the windows, and a new one is also made here if the
+ * windows have changed since, e.g. their damage has been removed.
+ * Typically called once per frame by a render thread.
+ * @param context The context
+ * @return The snapshot, with a reference taken which must be dropped
+ * with xcwm_snapshot_unref(), or NULL if the event loop hasn't started.
+ */
+xcwm_snapshot_t const *
+xcwm_snapshot_get(xcwm_context_t *context);
+
+/**
+ * Take another reference to a snapshot.
+ * @param snapshot The snapshot
+ * @return The snapshot
+ */
+xcwm_snapshot_t const *
+xcwm_snapshot_ref(xcwm_snapshot_t const *snapshot);
+
+/**
+ * Drop a reference to a snapshot, freeing it when it was the last.
+ * @param snapshot The snapshot
+ */
+void
+xcwm_snapshot_unref(xcwm_snapshot_t const *snapshot);
+
+
+#endif  /* _XCWM_SNAPSHOT_H_ */
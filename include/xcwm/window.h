@@ -73,6 +73,61 @@ enum xcwm_window_state_t {
 };
 typedef enum xcwm_window_state_t xcwm_window_state_t;
 
+/**
+ * Enumeration for the ways damage can be tracked on a window.
+ */
+enum xcwm_damage_mode_t {
+    /* The server reports the bounding box of each change. Cheapest,
+     * but separate small changes are reported as one large area. */
+    XCWM_DAMAGE_MODE_BOUNDING_BOX = 0,
+    /* The exact list of damaged rectangles is fetched from the
+     * server. The fetches are pipelined, and collected once per batch
+     * of events. */
+    XCWM_DAMAGE_MODE_EXACT
+};
+typedef enum xcwm_damage_mode_t xcwm_damage_mode_t;
+
+/**
+ * Take a reference to a window, so it isn't freed when it is
+ * destroyed. The window is no longer managed once the
+ * XCWM_EVENT_WINDOW_DESTROY event for it has been delivered, but may
+ * still be used, e.g. to collect an image request, until the
+ * reference is dropped.
+ * @param window The window.
+ * @return The window.
+ */
+xcwm_window_t *
+xcwm_window_ref(xcwm_window_t *window);
+
+/**
+ * Drop a reference taken with xcwm_window_ref(), freeing the window
+ * if it has been destroyed and this was the last reference.
+ * @param window The window.
+ */
+void
+xcwm_window_unref(xcwm_window_t *window);
+
+/**
+ * Lock the damage and geometry of a window. The event loop only holds
+ * this lock while updating this window, so holding it doesn't hold up
+ * events for any other window, but it should not be held while
+ * waiting for the server, e.g. while copying an image. Instead, copy
+ * the damaged rectangle with the window locked, then copy that area
+ * with xcwm_image_copy_area() and remove the damage, which removes
+ * only what was copied. The lock is recursive, and libxcwm functions
+ * called with it held take it again as needed.
+ * @param window The window to lock.
+ */
+void
+xcwm_window_lock(xcwm_window_t *window);
+
+/**
+ * Unlock a window locked with xcwm_window_lock().
+ * @param window The window to unlock.
+ */
+void
+xcwm_window_unlock(xcwm_window_t *window);
+
 /**
  * Set input focus to the window in context
  * @param window The window to set focus to
@@ -94,12 +149,34 @@ void
 xcwm_window_set_to_top(xcwm_window_t *window);
 
 /**
- * Remove the damage from a given window.
+ * Remove the damage from a given window. Only the damage copied by
+ * xcwm_image_copy_damaged() or xcwm_image_copy_area() since damage was
+ * last removed is removed, so damage reported after the copy is kept.
+ * If nothing was copied, all damage is removed. This does not wait for
+ * the server, any error is reported asynchronously by the event loop.
  * @param window The window to remove damage from
  */
 void
 xcwm_window_remove_damage(xcwm_window_t *window);
 
+/**
+ * Set how damage is tracked on the window. The whole window is
+ * damaged when the mode changes, and a damage event is delivered for
+ * it as for any other damage.
+ * @param window The window
+ * @param mode The damage mode
+ */
+void
+xcwm_window_set_damage_mode(xcwm_window_t *window, xcwm_damage_mode_t mode);
+
+/**
+ * Get how damage is tracked on the window.
+ * @param window The window
+ * @return The damage mode of the window.
+ */
+xcwm_damage_mode_t
+xcwm_window_get_damage_mode(xcwm_window_t const *window);
+
 /**
  * kill the window, if possible using WM_DELETE_WINDOW (icccm)
  * otherwise using xcb_kill_client.
@@ -186,20 +263,54 @@ xcwm_window_set_local_data(xcwm_window_t *window, void *data_ptr);
 
 /**
  * Get the rectangle describing the size and position of the window.
+ * This is kept up to date from ConfigureNotify events, so no request
+ * to the server is made.
  * @param window Window to get rectangle from.
  * @return The rectangle.
  */
 const xcwm_rect_t *
 xcwm_window_get_full_rect(xcwm_window_t const *window);
 
+/**
+ * Get the width of the border of the window.
+ * @param window Window to get border width from.
+ * @return The border width.
+ */
+int
+xcwm_window_get_border_width(xcwm_window_t const *window);
+
+/**
+ * Get the ID of the window this window is stacked immediately above.
+ * Windows may be destroyed at any time by the event loop, so only the
+ * ID is returned; look it up among the windows the client was told of.
+ * @param window The window.
+ * @return The sibling's ID, XCB_NONE if the window is at the bottom of
+ * the stack or the sibling is unknown.
+ */
+xcb_window_t
+xcwm_window_get_above_sibling_id(xcwm_window_t *window);
+
 /**
  * Get the damaged area within the given window.
  * @param window The window to get damage from.
- * @return Rectangle describing damaged area.
+ * @return Rectangle bounding all of the damaged area.
  */
 const xcwm_rect_t *
 xcwm_window_get_damaged_rect(xcwm_window_t const *window);
 
+/**
+ * Get the list of rectangles damaged within the given window since
+ * damage was last removed. Damage reported by separate events is
+ * accumulated, not replaced. The rectangles may cover slightly more
+ * than the exact damaged area, but never less.
+ * @param window The window to get damage from.
+ * @param[out] count The number of rectangles in the list.
+ * @return The damaged rectangles, valid until damage is next reported
+ * or removed.
+ */
+const xcwm_rect_t *
+xcwm_window_get_damaged_rects(xcwm_window_t const *window, int *count);
+
 /**
  * Get a copy of the name of the window. Client is responsible for freeing
  * memory created for the copy.
@@ -261,4 +372,75 @@ xcwm_window_get_opacity(xcwm_window_t const *window);
 xcb_rectangle_iterator_t
 xcwm_window_get_shape(xcwm_window_t const *window);
 
+/**
+ * Statistics of the damage reported on a window, averaged over the
+ * last few seconds. Both averages fall back towards 0 while the window
+ * isn't damaged.
+ */
+struct xcwm_damage_stats_t {
+    double events_per_second;   /* Damage events received */
+    double damaged_fraction;    /* Fraction of the window's area damaged
+                                 * by each event, 0 to 1 */
+    unsigned long events;       /* Damage events received in total */
+};
+typedef struct xcwm_damage_stats_t xcwm_damage_stats_t;
+
+/**
+ * Ways of copying the damaged contents of a window.
+ */
+enum xcwm_capture_strategy_t {
+    /* Copy each damaged rectangle, see xcwm_window_get_damaged_rects() */
+    XCWM_CAPTURE_EXACT = 0,
+    /* Copy the bounding box, see xcwm_image_copy_damaged() */
+    XCWM_CAPTURE_BOUNDING_BOX,
+    /* Copy the whole window, see xcwm_image_copy_full(), best combined
+     * with xcwm_window_set_max_fps() */
+    XCWM_CAPTURE_FULL
+};
+typedef enum xcwm_capture_strategy_t xcwm_capture_strategy_t;
+
+/**
+ * Get the statistics of the damage reported on a window.
+ * @param window The window
+ * @param[out] stats The statistics
+ */
+void
+xcwm_window_get_damage_stats(xcwm_window_t *window,
+                             xcwm_damage_stats_t *stats);
+
+/**
+ * Choose how best to copy the damaged contents of a window, from its
+ * current damage and how it has been damaged recently. Windows with a
+ * few small scattered changes are best copied exactly, windows which
+ * change most of their area, e.g. playing video, in full. Unless a limit
+ * has been set with xcwm_window_set_max_fps(), damage of windows copied
+ * in full is then delivered at most 30 times a second, until they are
+ * no longer copied in full.
+ * @param window The window
+ * @return The capture strategy
+ */
+xcwm_capture_strategy_t
+xcwm_window_get_capture_strategy(xcwm_window_t *window);
+
+/**
+ * Limit how often damage events are delivered for a window. Damage
+ * received in between is accumulated and delivered together. This
+ * replaces the limit chosen by xcwm_window_get_capture_strategy().
+ * @param window The window
+ * @param fps The most damage events to deliver a second, or 0 for no
+ * limit.
+ */
+void
+xcwm_window_set_max_fps(xcwm_window_t *window, unsigned int fps);
+
+/**
+ * Set how damage is tracked on windows created in this context from
+ * now on. Windows already created are not changed.
+ * @param context The context
+ * @param mode The damage mode
+ */
+void
+xcwm_context_set_damage_mode(xcwm_context_t *context,
+                             xcwm_damage_mode_t mode);
+
 #endif  /* _XCWM_WINDOW_H_ */
@@ -35,6 +35,8 @@
 #include <xcwm/event.h>
 #include <xcwm/input.h>
 #include <xcwm/image.h>
+#include <xcwm/shadow.h>
+#include <xcwm/snapshot.h>
 #include <xcwm/keyboard.h>
 #include <xcwm/atoms.h>
 
@@ -48,81 +48,314 @@ create_wm_cm_window(xcwm_context_t *context);
 
 /*
   The table of xcwm_property_t represents the window properties we take note of,
-  the function to update our internal state on a change of that property, and
+  the functions to update our internal state on a change of that property, and
   the event we send when that state changes.
+
+  Updating the state is split into sending the requests for the property's
+  value, and collecting their replies, so the requests for many properties
+  can be sent before waiting for any reply.
  */
 typedef struct xcwm_property_t xcwm_property_t;
 
-typedef void (xcwm_property_change_fn_t)(xcwm_window_t *window, xcwm_property_t *property);
+/* The most requests needed to get the value of a property */
+#define PROPERTY_MAX_COOKIES 2
+
+/* Send the requests, returning the number of cookies used */
+typedef int (xcwm_property_request_fn_t)(xcwm_window_t *window, xcwm_property_t *property, xcb_get_property_cookie_t *cookies);
+
+/* Collect the replies, and update our state */
+typedef void (xcwm_property_reply_fn_t)(xcwm_window_t *window, xcwm_property_t *property, xcb_get_property_cookie_t *cookies);
 
 struct xcwm_property_t
 {
     const char *name;
-    xcwm_property_change_fn_t *prop_change_fn;
+    xcwm_property_request_fn_t *request_fn;
+    xcwm_property_reply_fn_t *reply_fn;
     xcwm_event_type_t event;
     xcb_atom_t atom;
 };
 
+/*
+  The property table is replaced as a whole when properties are registered,
+  rather than changed, so the event thread can look atoms up in it without
+  taking a lock. Replaced tables are kept until the event thread has
+  finished draining events, as it may still be using them, and are freed
+  then by _xcwm_atoms_reclaim().
+ */
+struct xcwm_property_table_t
+{
+    unsigned int num_entries;
+    unsigned int index_mask;    /* Size of index - 1 */
+    int *index;                 /* Entry for each atom by hash, or -1 */
+    struct xcwm_property_table_t *replaced; /* The table this replaced */
+    xcwm_property_t entries[];
+};
+
+/* Cookies of the requests sent for one property */
+typedef struct xcwm_property_cookies_t {
+    xcb_get_property_cookie_t cookies[PROPERTY_MAX_COOKIES];
+    int num_cookies;
+    int changed;                /* 1 if this property has changed */
+} xcwm_property_cookies_t;
+
+/* Requests sent to take note of the properties of a window */
+struct _xcwm_atoms_request {
+    struct xcwm_property_table_t *table; /* Table the requests are for */
+    int has_protocols;          /* 1 if WM_PROTOCOLS was requested */
+    xcb_get_property_cookie_t protocols;
+    xcwm_property_cookies_t properties[]; /* One per property table entry */
+};
+
 /* Determine the window type */
+static int
+request_window_type(xcwm_window_t *window, xcwm_property_t *property,
+                    xcb_get_property_cookie_t *cookies);
 static void
-setup_window_type(xcwm_window_t *window, xcwm_property_t *property);
+setup_window_type(xcwm_window_t *window, xcwm_property_t *property,
+                  xcb_get_property_cookie_t *cookies);
 
 /* Get and set the size hints for the window */
+static int
+request_window_size_hints(xcwm_window_t *window, xcwm_property_t *property,
+                          xcb_get_property_cookie_t *cookies);
 static void
-set_window_size_hints(xcwm_window_t *window, xcwm_property_t *property);
+set_window_size_hints(xcwm_window_t *window, xcwm_property_t *property,
+                      xcb_get_property_cookie_t *cookies);
 
 /* Get opacity hint */
+static int
+request_window_opacity(xcwm_window_t *window, xcwm_property_t *property,
+                       xcb_get_property_cookie_t *cookies);
 static void
-set_window_opacity(xcwm_window_t *window, xcwm_property_t *property);
+set_window_opacity(xcwm_window_t *window, xcwm_property_t *property,
+                   xcb_get_property_cookie_t *cookies);
 
 /* Get window name */
+static int
+request_window_name(xcwm_window_t *window, xcwm_property_t *property,
+                    xcb_get_property_cookie_t *cookies);
+static void
+set_window_name(xcwm_window_t *window, xcwm_property_t *property,
+                xcb_get_property_cookie_t *cookies);
+
+/* Get WM_PROTOCOLS, to see if WM_DELETE_WINDOW is set */
+static xcb_get_property_cookie_t
+request_wm_delete(xcwm_window_t *window);
 static void
-set_window_name(xcwm_window_t *window, xcwm_property_t *property);
+set_wm_delete(xcwm_window_t *window, xcb_get_property_cookie_t cookie);
 
-static xcwm_property_t *property_table = NULL;
-static unsigned int property_table_entries = 0;;
+/* Update our state from the current value of a property */
+static void
+property_change(xcwm_window_t *window, xcwm_property_t *property)
+{
+    xcb_get_property_cookie_t cookies[PROPERTY_MAX_COOKIES];
+
+    if (property->request_fn) {
+        property->request_fn(window, property, cookies);
+        property->reply_fn(window, property, cookies);
+    }
+}
+
+/* Send the requests to intern a list of atoms */
+static void
+intern_atoms_request(xcwm_context_t *context, const char **names, int count,
+                     xcb_intern_atom_cookie_t *cookies)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        cookies[i] = xcb_intern_atom(context->conn,
+                                     0,
+                                     strlen(names[i]),
+                                     names[i]);
+    }
+}
 
-static xcb_atom_t
-_xcwm_atom_get(xcwm_context_t *context, const char *atomName)
+/* Collect the replies to intern_atoms_request() */
+static void
+intern_atoms_reply(xcwm_context_t *context, xcb_intern_atom_cookie_t *cookies,
+                   int count, xcb_atom_t *atoms)
 {
     xcb_intern_atom_reply_t *atom_reply;
-    xcb_intern_atom_cookie_t atom_cookie;
-    xcb_atom_t atom = XCB_NONE;
-
-    atom_cookie = xcb_intern_atom(context->conn,
-                                  0,
-                                  strlen(atomName),
-                                  atomName);
-    atom_reply = xcb_intern_atom_reply(context->conn,
-                                       atom_cookie,
-                                       NULL);
-    if (atom_reply) {
-        atom = atom_reply->atom;
-        free(atom_reply);
+    int i;
+
+    for (i = 0; i < count; i++) {
+        atoms[i] = XCB_NONE;
+        atom_reply = xcb_intern_atom_reply(context->conn,
+                                           cookies[i],
+                                           NULL);
+        if (atom_reply) {
+            atoms[i] = atom_reply->atom;
+            free(atom_reply);
+        }
+    }
+}
+
+static unsigned int
+atom_hash(xcb_atom_t atom)
+{
+    atom = ((atom >> 16) ^ atom) * 0x45d9f3b;
+    return (atom >> 16) ^ atom;
+}
+
+/* Get the current property table */
+static struct xcwm_property_table_t *
+property_table_get(xcwm_context_t *context)
+{
+    return __atomic_load_n(&context->property_table, __ATOMIC_ACQUIRE);
+}
+
+/* Create a table of the entries in an old table, followed by the new
+ * properties */
+static struct xcwm_property_table_t *
+property_table_create(struct xcwm_property_table_t *old,
+                      const xcwm_property_t *properties,
+                      const xcb_atom_t *atoms, int count)
+{
+    struct xcwm_property_table_t *table;
+    unsigned int num_old = old ? old->num_entries : 0;
+    unsigned int num_entries = num_old + count;
+    unsigned int size = 16;
+    unsigned int i;
+
+    /* Keep the index at most half full */
+    while (size < num_entries * 2)
+        size <<= 1;
+
+    table = malloc(sizeof(struct xcwm_property_table_t)
+                   + num_entries * sizeof(xcwm_property_t)
+                   + size * sizeof(int));
+    assert(table);
+
+    table->num_entries = num_entries;
+    table->index_mask = size - 1;
+    table->index = (int *)&table->entries[num_entries];
+    table->replaced = old;
+
+    if (num_old)
+        memcpy(table->entries, old->entries,
+               num_old * sizeof(xcwm_property_t));
+    for (i = 0; i < count; i++) {
+        table->entries[num_old + i] = properties[i];
+        table->entries[num_old + i].atom = atoms[i];
+    }
+
+    for (i = 0; i < size; i++)
+        table->index[i] = -1;
+
+    for (i = 0; i < num_entries; i++) {
+        xcb_atom_t atom = table->entries[i].atom;
+        unsigned int slot = atom_hash(atom) & table->index_mask;
+
+        if (atom == XCB_NONE)
+            continue;
+
+        /* If an atom is registered more than once, the first entry
+         * is used */
+        while (table->index[slot] != -1
+               && table->entries[table->index[slot]].atom != atom)
+            slot = (slot + 1) & table->index_mask;
+        if (table->index[slot] == -1)
+            table->index[slot] = i;
     }
-    return atom;
+
+    return table;
 }
 
+/* Find the property for an atom */
 static xcwm_property_t *
-_xcwm_atom_register(xcwm_context_t *context, const char *name, xcwm_property_change_fn_t *prop_change_fn, xcwm_event_type_t event)
+property_table_lookup(struct xcwm_property_table_t *table, xcb_atom_t atom)
 {
-    // XXX: what if atom is already registered?
-    property_table_entries++;
-    property_table = realloc(property_table, property_table_entries * sizeof(struct xcwm_property_t));
+    unsigned int slot;
+
+    if (!table || atom == XCB_NONE)
+        return NULL;
 
-    xcwm_property_t *new_property = &(property_table[property_table_entries - 1]);
-    new_property->name = name;
-    new_property->prop_change_fn = prop_change_fn;
-    new_property->event = event;
-    new_property->atom = _xcwm_atom_get(context, name);
+    slot = atom_hash(atom) & table->index_mask;
+    while (table->index[slot] != -1) {
+        xcwm_property_t *property = &table->entries[table->index[slot]];
 
-    return new_property;
+        if (property->atom == atom)
+            return property;
+        slot = (slot + 1) & table->index_mask;
+    }
+
+    return NULL;
+}
+
+/* Add a list of properties to the table, interning all their atoms
+ * with one round trip */
+static void
+_xcwm_atom_register_list(xcwm_context_t *context,
+                         const xcwm_property_t *properties, int count,
+                         xcb_atom_t *atoms_return)
+{
+    struct xcwm_property_table_t *table;
+    xcb_intern_atom_cookie_t *cookies;
+    xcb_atom_t *atoms;
+    const char **names;
+    int i;
+
+    cookies = malloc(count * sizeof(xcb_intern_atom_cookie_t));
+    atoms = malloc(count * sizeof(xcb_atom_t));
+    names = malloc(count * sizeof(const char *));
+    assert(cookies && atoms && names);
+
+    for (i = 0; i < count; i++)
+        names[i] = properties[i].name;
+    intern_atoms_request(context, names, count, cookies);
+
+    intern_atoms_reply(context, cookies, count, atoms);
+
+    /* Publish a new table including the properties */
+    pthread_mutex_lock(&context->property_table_lock);
+    table = property_table_create(context->property_table,
+                                  properties, atoms, count);
+    __atomic_store_n(&context->property_table, table, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&context->property_table_lock);
+
+    if (atoms_return)
+        memcpy(atoms_return, atoms, count * sizeof(xcb_atom_t));
+
+    free(names);
+    free(atoms);
+    free(cookies);
 }
 
 xcb_atom_t
 xcwm_atom_register(xcwm_context_t *context, const char *atom, xcwm_event_type_t event)
 {
-    return _xcwm_atom_register(context, atom, NULL, event)->atom;
+    xcb_atom_t result;
+
+    xcwm_atom_register_list(context, &atom, &event, 1, &result);
+    return result;
+}
+
+void
+xcwm_atom_register_list(xcwm_context_t *context, const char **atoms,
+                        const xcwm_event_type_t *events, int count,
+                        xcb_atom_t *atoms_return)
+{
+    xcwm_property_t *properties;
+    int i;
+
+    if (count <= 0)
+        return;
+
+    properties = malloc(count * sizeof(xcwm_property_t));
+    assert(properties);
+
+    for (i = 0; i < count; i++) {
+        properties[i].name = atoms[i];
+        properties[i].request_fn = NULL;
+        properties[i].reply_fn = NULL;
+        properties[i].event = events[i];
+        properties[i].atom = XCB_NONE;
+    }
+
+    _xcwm_atom_register_list(context, properties, count, atoms_return);
+
+    free(properties);
 }
 
 int
@@ -131,9 +364,42 @@ _xcwm_atoms_init(xcwm_context_t *context)
     xcb_intern_atom_cookie_t *atom_cookies;
     xcb_generic_error_t *error;
 
+    /* The other atoms we need that are not included in the
+     * xcb_ewmh_connection_t. */
+    const char *names[] =
+        {
+            /* Used erroneously instead of _NET_WM_WINDOW_TYPE_SPLASH by some applications */
+            "_NET_WM_WINDOW_TYPE_SPLASHSCREEN",
+            "WM_DELETE_WINDOW",
+            "WM_STATE"
+        };
+    xcb_intern_atom_cookie_t cookies[3];
+    xcb_atom_t atoms[3];
+
+    /* The properties we take note of */
+    const xcwm_property_t properties[] =
+        {
+            { "_NET_WM_NAME",           request_window_name,       set_window_name,       XCWM_EVENT_WINDOW_NAME,       XCB_NONE },
+            { "WM_NAME",                request_window_name,       set_window_name,       XCWM_EVENT_WINDOW_NAME,       XCB_NONE },
+            { "_NET_WM_WINDOW_TYPE",    request_window_type,       setup_window_type,     XCWM_EVENT_WINDOW_APPEARANCE, XCB_NONE },
+            { "WM_NORMAL_HINTS",        request_window_size_hints, set_window_size_hints, 0,                            XCB_NONE },
+            { "_NET_WM_WINDOW_OPACITY", request_window_opacity,    set_window_opacity,    XCWM_EVENT_WINDOW_APPEARANCE, XCB_NONE }
+        };
+
+    /* Send all the requests to intern atoms before waiting for any
+     * replies, so they are answered with one round trip */
+
     /* Initialization for the xcb_ewmh connection and EWMH atoms */
     atom_cookies = xcb_ewmh_init_atoms(context->conn,
                                        &context->atoms.ewmh_conn);
+    intern_atoms_request(context, names, 3, cookies);
+    _xcwm_atom_register_list(context, properties, 5, NULL);
+    intern_atoms_reply(context, cookies, 3, atoms);
+
+    context->atoms.net_wm_window_type_splashscreen = atoms[0];
+    context->atoms.wm_delete_window_atom = atoms[1];
+    context->atoms.wm_state_atom = atoms[2];
+
     if (!xcb_ewmh_init_atoms_replies(&context->atoms.ewmh_conn,
                                      atom_cookies, &error)) {
         return error->major_code;;
@@ -174,28 +440,11 @@ _xcwm_atoms_init(xcwm_context_t *context)
                            21,  /* Length of supported[] */
                            supported);
 
-    /* Used erroneously instead of _NET_WM_WINDOW_TYPE_SPLASH by some applications */
-    context->atoms.net_wm_window_type_splashscreen = _xcwm_atom_get(context, "_NET_WM_WINDOW_TYPE_SPLASHSCREEN");
-
-    /* Get the ICCCM atoms we need that are not included in the
-     * xcb_ewmh_connection_t. */
-    _xcwm_atom_register(context, "_NET_WM_NAME",           set_window_name,       XCWM_EVENT_WINDOW_NAME);
-    _xcwm_atom_register(context, "WM_NAME",                set_window_name,       XCWM_EVENT_WINDOW_NAME);
-    _xcwm_atom_register(context, "_NET_WM_WINDOW_TYPE",    setup_window_type,     XCWM_EVENT_WINDOW_APPEARANCE);
-    _xcwm_atom_register(context, "WM_NORMAL_HINTS",        set_window_size_hints, 0);
-    _xcwm_atom_register(context, "_NET_WM_WINDOW_OPACITY", set_window_opacity,    XCWM_EVENT_WINDOW_APPEARANCE);
-
-    /* WM_DELETE_WINDOW atom */
-    context->atoms.wm_delete_window_atom = _xcwm_atom_get(context, "WM_DELETE_WINDOW");
-
     if (!check_wm_cm_owner(context)) {
         return XCB_WINDOW;
     }
     create_wm_cm_window(context);
 
-    /* WM_STATE atom */
-    context->atoms.wm_state_atom = _xcwm_atom_get(context, "WM_STATE");
-
     return 0;
 }
 
@@ -259,59 +508,209 @@ create_wm_cm_window(xcwm_context_t *context)
      use an actual timestamp, so in the case of races, we either acquire selection or don't */
 }
 
-void
-_xcwm_atoms_init_window(xcwm_window_t *window)
+/* Create an empty request for properties of the window */
+static struct _xcwm_atoms_request *
+atoms_request_create(xcwm_window_t *window)
+{
+    struct xcwm_property_table_t *table = property_table_get(window->context);
+    unsigned int num_entries = table ? table->num_entries : 0;
+    struct _xcwm_atoms_request *request;
+
+    request = calloc(1, sizeof(struct _xcwm_atoms_request)
+                     + num_entries * sizeof(xcwm_property_cookies_t));
+    assert(request);
+
+    request->table = table;
+
+    return request;
+}
+
+/* Request the value of a property table entry */
+static void
+atoms_request_send(xcwm_window_t *window, struct _xcwm_atoms_request *request,
+                   unsigned int i)
 {
-    _xcwm_atoms_set_wm_delete(window);
+    struct xcwm_property_table_t *table = request->table;
+    xcwm_property_t *property = &(table->entries[i]);
+    unsigned int j;
+
+    if (!property->request_fn || request->properties[i].num_cookies)
+        return;
+
+    /* Several properties may be considered together, e.g. both
+     * names, so only request them once */
+    for (j = 0; j < table->num_entries; j++) {
+        if (request->properties[j].num_cookies
+            && table->entries[j].reply_fn == property->reply_fn)
+            return;
+    }
+
+    request->properties[i].num_cookies =
+        (property->request_fn)(window, property,
+                               request->properties[i].cookies);
+}
 
-    /* Put the value of all properties we consider into effect */
+/* Collect the replies to a request and free it. Returns a mask of the
+ * events for the properties which have changed */
+static uint32_t
+atoms_request_collect(xcwm_window_t *window,
+                      struct _xcwm_atoms_request *request)
+{
+    struct xcwm_property_table_t *table = request->table;
+    uint32_t events = 0;
     unsigned int i;
-    for (i = 0; i < property_table_entries; i++)
+
+    if (request->has_protocols)
+        set_wm_delete(window, request->protocols);
+
+    /* Put the value of all properties requested into effect */
+    for (i = 0; table && i < table->num_entries; i++)
     {
-        if (property_table[i].prop_change_fn)
-            (property_table[i].prop_change_fn)(window, &(property_table[i]));
+        xcwm_property_t *property = &(table->entries[i]);
+
+        if (request->properties[i].num_cookies)
+            (property->reply_fn)(window, property,
+                                 request->properties[i].cookies);
+        if (request->properties[i].changed)
+            events |= 1 << property->event;
     }
+
+    free(request);
+
+    return events;
 }
 
-int
-_xcwm_atom_change_to_event(xcb_atom_t atom, xcwm_window_t *window, xcwm_event_type_t *event)
+struct _xcwm_atoms_request *
+_xcwm_atoms_request_window(xcwm_window_t *window)
 {
+    struct _xcwm_atoms_request *request = atoms_request_create(window);
     unsigned int i;
-    for (i = 0; i < property_table_entries; i++) {
-        if (property_table[i].atom == atom) {
-            /* Take the value into consideration */
-            if (property_table[i].prop_change_fn)
-                (property_table[i].prop_change_fn)(window, &(property_table[i]));
-
-            /* and translate to XCWM_ event */
-            *event = property_table[i].event;
-            return 1;
+
+    request->has_protocols = 1;
+    request->protocols = request_wm_delete(window);
+
+    /* Request the value of all properties we consider */
+    for (i = 0; request->table && i < request->table->num_entries; i++)
+        atoms_request_send(window, request, i);
+
+    return request;
+}
+
+void
+_xcwm_atoms_reply_window(xcwm_window_t *window,
+                         struct _xcwm_atoms_request *request)
+{
+    atoms_request_collect(window, request);
+}
+
+struct _xcwm_atoms_request *
+_xcwm_atoms_request_changes(xcwm_window_t *window, const xcb_atom_t *atoms,
+                            int count)
+{
+    struct _xcwm_atoms_request *request = atoms_request_create(window);
+    int i;
+
+    for (i = 0; i < count; i++) {
+        xcwm_property_t *property;
+
+        /* WM_PROTOCOLS is handled internally */
+        if (atoms[i] == window->context->atoms.ewmh_conn.WM_PROTOCOLS) {
+            if (!request->has_protocols) {
+                request->has_protocols = 1;
+                request->protocols = request_wm_delete(window);
+            }
+            continue;
+        }
+
+        property = property_table_lookup(request->table, atoms[i]);
+        if (!property) {
+            printf("PROPERTY_NOTIFY for ignored property atom %d\n",
+                   atoms[i]);
+            continue;
         }
+
+        request->properties[property - request->table->entries].changed = 1;
+        atoms_request_send(window, request,
+                           property - request->table->entries);
     }
 
-    return 0;
+    return request;
+}
+
+uint32_t
+_xcwm_atoms_reply_changes(xcwm_window_t *window,
+                          struct _xcwm_atoms_request *request)
+{
+    return atoms_request_collect(window, request);
 }
 
 void
-set_window_name(xcwm_window_t *window, xcwm_property_t *property)
+_xcwm_atoms_discard_window(xcwm_context_t *context,
+                           struct _xcwm_atoms_request *request)
+{
+    unsigned int i;
+    int j;
+
+    if (request->has_protocols)
+        xcb_discard_reply(context->conn, request->protocols.sequence);
+    for (i = 0; request->table && i < request->table->num_entries; i++) {
+        for (j = 0; j < request->properties[i].num_cookies; j++) {
+            xcb_discard_reply(context->conn,
+                              request->properties[i].cookies[j].sequence);
+        }
+    }
+
+    free(request);
+}
+
+int
+_xcwm_atom_change_to_event(xcb_atom_t atom, xcwm_window_t *window, xcwm_event_type_t *event)
+{
+    xcwm_property_t *property =
+        property_table_lookup(property_table_get(window->context), atom);
+
+    if (!property)
+        return 0;
+
+    /* Take the value into consideration */
+    property_change(window, property);
+
+    /* and translate to XCWM_ event */
+    *event = property->event;
+    return 1;
+}
+
+static int
+request_window_name(xcwm_window_t *window, xcwm_property_t *property,
+                    xcb_get_property_cookie_t *cookies)
+{
+    cookies[0] = xcb_ewmh_get_wm_name(&window->context->atoms.ewmh_conn,
+                                      window->window_id);
+    cookies[1] = xcb_icccm_get_wm_name(window->context->conn,
+                                       window->window_id);
+    return 2;
+}
+
+static void
+set_window_name(xcwm_window_t *window, xcwm_property_t *property,
+                xcb_get_property_cookie_t *cookies)
 {
-    xcb_get_property_cookie_t cookie;
     xcb_icccm_get_text_property_reply_t reply;
     xcb_ewmh_get_utf8_strings_reply_t data;
 
+    free(window->name);
+
     /* Check _NET_WM_NAME first */
-    cookie = xcb_ewmh_get_wm_name(&window->context->atoms.ewmh_conn,
-                                  window->window_id);
     if (xcb_ewmh_get_wm_name_reply(&window->context->atoms.ewmh_conn,
-                                   cookie, &data, NULL)) {
+                                   cookies[0], &data, NULL)) {
         window->name = strndup(data.strings, data.strings_len);
         xcb_ewmh_get_utf8_strings_reply_wipe(&data);
+        xcb_discard_reply(window->context->conn, cookies[1].sequence);
         return;
     }
 
-    cookie = xcb_icccm_get_wm_name(window->context->conn, window->window_id);
     if (!xcb_icccm_get_wm_name_reply(window->context->conn,
-                                     cookie, &reply, NULL)) {
+                                     cookies[1], &reply, NULL)) {
         window->name = malloc(sizeof(char));
         window->name[0] = '\0';
         return;
@@ -325,16 +724,25 @@ set_window_name(xcwm_window_t *window, xcwm_property_t *property)
 void
 _xcwm_atoms_set_wm_delete(xcwm_window_t *window)
 {
-    xcb_get_property_cookie_t cookie;
+    set_wm_delete(window, request_wm_delete(window));
+}
+
+static xcb_get_property_cookie_t
+request_wm_delete(xcwm_window_t *window)
+{
+    /* Get the WM_PROTOCOLS */
+    return xcb_icccm_get_wm_protocols(window->context->conn,
+                                      window->window_id,
+                                      window->context->atoms.ewmh_conn.WM_PROTOCOLS);
+}
+
+static void
+set_wm_delete(xcwm_window_t *window, xcb_get_property_cookie_t cookie)
+{
     xcb_icccm_get_wm_protocols_reply_t reply;
     xcb_generic_error_t *error;
     int i;
 
-    /* Get the WM_PROTOCOLS */
-    cookie = xcb_icccm_get_wm_protocols(window->context->conn,
-                                        window->window_id,
-                                        window->context->atoms.ewmh_conn.WM_PROTOCOLS);
-
     if (xcb_icccm_get_wm_protocols_reply(window->context->conn,
                                          cookie, &reply, &error) == 1) {
         /* See if the WM_DELETE_WINDOW is set in WM_PROTOCOLS */
@@ -353,10 +761,22 @@ _xcwm_atoms_set_wm_delete(xcwm_window_t *window)
     return;
 }
 
+static int
+request_window_type(xcwm_window_t *window, xcwm_property_t *property,
+                    xcb_get_property_cookie_t *cookies)
+{
+    cookies[0] = xcb_icccm_get_wm_transient_for(window->context->conn,
+                                                window->window_id);
+    cookies[1] =
+        xcb_ewmh_get_wm_window_type(&window->context->atoms.ewmh_conn,
+                                    window->window_id);
+    return 2;
+}
+
 static void
-setup_window_type(xcwm_window_t *window, xcwm_property_t *property)
+setup_window_type(xcwm_window_t *window, xcwm_property_t *property,
+                  xcb_get_property_cookie_t *cookies)
 {
-    xcb_get_property_cookie_t cookie;
     xcb_window_t transient;
     xcb_ewmh_get_atoms_reply_t type;
     xcb_ewmh_connection_t ewmh_conn = window->context->atoms.ewmh_conn;
@@ -366,11 +786,10 @@ setup_window_type(xcwm_window_t *window, xcwm_property_t *property)
     window->type = XCWM_WINDOW_TYPE_UNKNOWN;
 
     /* Get the window this one is transient for */
-    cookie = xcb_icccm_get_wm_transient_for(window->context->conn,
-                                            window->window_id);
-    if (xcb_icccm_get_wm_transient_for_reply(window->context->conn, cookie,
-                                             &transient, NULL)) {
-        window->transient_for = _xcwm_get_window_node_by_window_id(transient);
+    if (xcb_icccm_get_wm_transient_for_reply(window->context->conn,
+                                             cookies[0], &transient, NULL)) {
+        window->transient_for = _xcwm_get_window_node_by_window_id(window->context,
+                                                                   transient);
         window->type = XCWM_WINDOW_TYPE_DIALOG;
         // not if override-redirect
     } else {
@@ -382,8 +801,8 @@ setup_window_type(xcwm_window_t *window, xcwm_property_t *property)
      * atom. Since the "type" is a list of window types, ordered by
      * preference, we need to loop through to make sure we get a
      * match. */
-    cookie = xcb_ewmh_get_wm_window_type(&ewmh_conn, window->window_id);
-    if (xcb_ewmh_get_wm_window_type_reply(&ewmh_conn, cookie, &type, NULL)) {
+    if (xcb_ewmh_get_wm_window_type_reply(&ewmh_conn, cookies[1], &type,
+                                          NULL)) {
         for (i = 0; i < type.atoms_len; i++) {
             if (type.atoms[i] ==  ewmh_conn._NET_WM_WINDOW_TYPE_DESKTOP) {
                 window->type = XCWM_WINDOW_TYPE_DESKTOP;
@@ -438,26 +857,39 @@ setup_window_type(xcwm_window_t *window, xcwm_property_t *property)
     }
 }
 
-void
-set_window_size_hints(xcwm_window_t *window, xcwm_property_t *property)
+static int
+request_window_size_hints(xcwm_window_t *window, xcwm_property_t *property,
+                          xcb_get_property_cookie_t *cookies)
+{
+    cookies[0] = xcb_icccm_get_wm_normal_hints(window->context->conn,
+                                               window->window_id);
+    return 1;
+}
+
+static void
+set_window_size_hints(xcwm_window_t *window, xcwm_property_t *property,
+                      xcb_get_property_cookie_t *cookies)
 {
-    xcb_get_property_cookie_t cookie;
-    cookie = xcb_icccm_get_wm_normal_hints(window->context->conn,
-                                           window->window_id);
     if (!xcb_icccm_get_wm_normal_hints_reply(window->context->conn,
-                                             cookie, &(window->size_hints), NULL)) {
+                                             cookies[0], &(window->size_hints), NULL)) {
         /* Use 0 for all values (as set in calloc), or previous values */
         return;
     }
 }
 
-void
-set_window_opacity(xcwm_window_t *window, xcwm_property_t *property)
+static int
+request_window_opacity(xcwm_window_t *window, xcwm_property_t *property,
+                       xcb_get_property_cookie_t *cookies)
 {
-  xcb_get_property_cookie_t cookie;
-  cookie = xcb_get_property(window->context->conn, 0, window->window_id, property->atom, XCB_ATOM_CARDINAL, 0L, 4L);
+  cookies[0] = xcb_get_property(window->context->conn, 0, window->window_id, property->atom, XCB_ATOM_CARDINAL, 0L, 4L);
+  return 1;
+}
 
-  xcb_get_property_reply_t *reply = xcb_get_property_reply(window->context->conn, cookie, NULL);
+static void
+set_window_opacity(xcwm_window_t *window, xcwm_property_t *property,
+                   xcb_get_property_cookie_t *cookies)
+{
+  xcb_get_property_reply_t *reply = xcb_get_property_reply(window->context->conn, cookies[0], NULL);
   if (reply)
     {
       int nitems = xcb_get_property_value_length(reply);
@@ -523,13 +955,41 @@ _xcwm_atoms_set_wm_state(xcwm_window_t *window, xcwm_window_state_t state)
                           ewmh_atom_cnt,
                           ewmh_state);
 
-    xcb_flush(window->context->conn);
+    _xcwm_flush(window->context);
 
     if (ewmh_state) {
         free(ewmh_state);
     }
 }
 
+/* Free a table and those it replaced */
+static void
+property_table_free(struct xcwm_property_table_t *table)
+{
+    while (table) {
+        struct xcwm_property_table_t *replaced = table->replaced;
+
+        free(table);
+        table = replaced;
+    }
+}
+
+void
+_xcwm_atoms_reclaim(xcwm_context_t *context)
+{
+    struct xcwm_property_table_t *replaced = NULL;
+
+    /* Only the event thread reads the tables, and it isn't now */
+    pthread_mutex_lock(&context->property_table_lock);
+    if (context->property_table) {
+        replaced = context->property_table->replaced;
+        context->property_table->replaced = NULL;
+    }
+    pthread_mutex_unlock(&context->property_table_lock);
+
+    property_table_free(replaced);
+}
+
 void
 _xcwm_atoms_release(xcwm_context_t *context)
 {
@@ -537,6 +997,11 @@ _xcwm_atoms_release(xcwm_context_t *context)
     /* Free the xcb_ewmh_connection_t */
     xcb_ewmh_connection_wipe(&context->atoms.ewmh_conn);
 
+    /* Free the table of properties we take note of, and those it
+     * replaced */
+    property_table_free(context->property_table);
+    context->property_table = NULL;
+
     /* Close the wm window */
     xcb_destroy_window(context->conn, context->wm_cm_window);
 }
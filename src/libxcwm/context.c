@@ -84,8 +84,43 @@ xcwm_context_open(char *display)
 
     root_context->conn = conn;
     root_context->conn_screen = conn_screen;
+    root_context->windows.slots = NULL;
+    root_context->windows.size = 0;
+    root_context->windows.count = 0;
+    root_context->property_table = NULL;
+    pthread_mutex_init(&root_context->property_table_lock, NULL);
+    root_context->event_callback = NULL;
+    root_context->error_callback = NULL;
+    root_context->event_ring = NULL;
+    root_context->stacking = NULL;
+    root_context->num_stacking = 0;
+    root_context->max_stacking = 0;
+    root_context->snapshot = NULL;
+    pthread_mutex_init(&root_context->snapshot_lock, NULL);
+    root_context->snapshot_dirty = 1;
+    root_context->snapshot_generation = 0;
+    root_context->num_tracked = 0;
+    pthread_mutex_init(&root_context->tracked_lock, NULL);
+    root_context->event_thread = 0;
+    root_context->event_stop = 0;
+    root_context->event_shared = 0;
+    root_context->event_prepared = 0;
+    root_context->event_batching = 0;
+    root_context->frame_interval = 0;
+    root_context->next_frame = 0;
+    root_context->damage_mode = XCWM_DAMAGE_MODE_BOUNDING_BOX;
+    root_context->pending_windows = NULL;
+    root_context->num_pending_windows = 0;
+    root_context->max_pending_windows = 0;
+    root_context->batch_events = 0;
+    root_context->batch_merged = 0;
+    root_context->batch_property_events = 0;
+    pthread_key_create(&root_context->batch_depth, NULL);
+    memset(&root_context->stats, 0, sizeof(xcwm_context_stats_t));
+    pthread_mutex_init(&root_context->event_thread_lock, NULL);
     root_context->root_window->parent = 0;
     root_context->root_window->window_id = root_window_id;
+    root_context->root_window->refs = 1;
     /* FIXME: Should we have a circular assignment like this? */
     root_context->root_window->context = root_context;
 
@@ -94,6 +129,30 @@ xcwm_context_open(char *display)
     root_context->root_window->bounds.height = root_screen->height_in_pixels;
     root_context->root_window->bounds.x = 0;
     root_context->root_window->bounds.y = 0;
+    root_context->root_window->damage_mode = XCWM_DAMAGE_MODE_BOUNDING_BOX;
+    root_context->root_window->dmg_parts = 0;
+    root_context->root_window->num_dmg_fetches = 0;
+    root_context->root_window->dmg_removed = 0;
+    root_context->root_window->shm_seg = 0;
+    root_context->root_window->shm_addr = NULL;
+    root_context->root_window->shm_size = 0;
+    root_context->root_window->shm_busy = 0;
+    root_context->root_window->shm_closed = 0;
+    root_context->root_window->snapshot_seq = 0;
+    root_context->root_window->stacking_index = -1;
+    root_context->root_window->shadow = NULL;
+    _xcwm_window_lock_init(root_context->root_window);
+    memset(&root_context->root_window->dmg_stats, 0,
+           sizeof(_xcwm_damage_stats));
+    root_context->root_window->damage_interval = 0;
+    root_context->root_window->damage_interval_set = 0;
+    root_context->root_window->next_damage = 0;
+    _xcwm_region_init(&root_context->root_window->dmg_region);
+    _xcwm_region_init(&root_context->root_window->dmg_captured);
+    root_context->root_window->pending = 0;
+    root_context->root_window->pending_atoms = NULL;
+    root_context->root_window->num_pending_atoms = 0;
+    root_context->root_window->max_pending_atoms = 0;
 
     _xcwm_init_composite(root_context);
 
@@ -103,6 +162,8 @@ xcwm_context_open(char *display)
 
     _xcwm_init_shape(root_context);
 
+    _xcwm_init_shm(root_context);
+
     /* Add the root window to our list of windows being managed */
     _xcwm_add_window(root_context->root_window);
 
@@ -123,25 +184,34 @@ void
 xcwm_context_close(xcwm_context_t *context)
 {
 
-    _xcwm_window_node *head = _xcwm_window_list_head;
+    unsigned int i;
 
     xcb_flush(context->conn);
 
+    // Terminate the event loop first, as it uses everything freed below
+    if (_xcwm_event_stop_loop(context) != 0) {
+        printf("Event loop failed to close\n");
+    }
+
     // Close all windows
-    while (head) {
-        xcwm_window_request_close(head->window);
-        _xcwm_window_list_head = head->next;
-        free(head);
-        head = _xcwm_window_list_head;
+    for (i = 0; i < context->windows.size; i++) {
+        if (context->windows.slots[i]) {
+            xcwm_window_request_close(context->windows.slots[i]);
+            _xcwm_image_shm_release(context->windows.slots[i]);
+        }
     }
+    _xcwm_window_table_clear(context);
+
+    free(context->pending_windows);
+    _xcwm_event_ring_release(context);
+    _xcwm_snapshot_release(context);
+    context->pending_windows = NULL;
+    context->num_pending_windows = 0;
 
     /* Free atom related stuff */
     _xcwm_atoms_release(context);
 
-    // Terminate the event loop
-    if (_xcwm_event_stop_loop() != 1) {
-        printf("Event loop failed to close\n");
-    }
+    pthread_key_delete(context->batch_depth);
 
     // Disconnect from the display
     xcb_disconnect(context->conn);
@@ -160,3 +230,43 @@ xcwm_context_get_connection(xcwm_context_t const *context)
 {
     return context->conn;
 }
+
+void
+xcwm_context_get_stats(xcwm_context_t const *context,
+                       xcwm_context_stats_t *stats)
+{
+    *stats = context->stats;
+}
+
+void
+xcwm_context_begin_batch(xcwm_context_t *context)
+{
+    intptr_t depth =
+        (intptr_t)pthread_getspecific(context->batch_depth);
+
+    pthread_setspecific(context->batch_depth, (void *)(depth + 1));
+}
+
+void
+xcwm_context_commit(xcwm_context_t *context)
+{
+    intptr_t depth =
+        (intptr_t)pthread_getspecific(context->batch_depth);
+
+    if (depth > 0) {
+        pthread_setspecific(context->batch_depth, (void *)(depth - 1));
+    }
+    _xcwm_flush(context);
+}
+
+int
+xcwm_context_get_fd(xcwm_context_t const *context)
+{
+    return xcb_get_file_descriptor(context->conn);
+}
+
+int
+xcwm_context_get_timeout(xcwm_context_t *context)
+{
+    return _xcwm_event_timeout(context);
+}
@@ -29,77 +29,169 @@
 
 #include "xcwm_internal.h"
 
-_xcwm_window_node *_xcwm_window_list_head = NULL;
+/* Number of slots allocated when the first window is added */
+#define WINDOW_TABLE_INITIAL_SIZE 64
 
-xcwm_window_t *
-_xcwm_add_window(xcwm_window_t *window)
+/* Functions only used within this file */
+
+/* Hash a window id into the slot range of the table */
+static unsigned int
+window_table_hash(xcb_window_t window_id, unsigned int size);
+
+/* Double the size of the table and re-insert all windows */
+static void
+window_table_grow(_xcwm_window_table *table);
+
+/* Find the slot holding the given window id, -1 if not present */
+static int
+window_table_find_slot(_xcwm_window_table const *table,
+                       xcb_window_t window_id);
+
+static unsigned int
+window_table_hash(xcb_window_t window_id, unsigned int size)
 {
-    _xcwm_window_node *new_node;
+    uint32_t h = window_id;
+
+    /* Window ids are a client resource base with a small counter in
+     * the low bits, so mix all the bits before masking */
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
 
-    /* Create node to hold the new window */
-    new_node = malloc(sizeof(_xcwm_window_node));
-    if (!new_node) {
+    return h & (size - 1);
+}
+
+static void
+window_table_grow(_xcwm_window_table *table)
+{
+    xcwm_window_t **old_slots = table->slots;
+    unsigned int old_size = table->size;
+    unsigned int i;
+
+    if (old_size) {
+        table->size = old_size * 2;
+    } else {
+        table->size = WINDOW_TABLE_INITIAL_SIZE;
+    }
+    table->slots = calloc(table->size, sizeof(xcwm_window_t *));
+    if (!table->slots) {
         exit(1);
     }
-    new_node->window = window;
 
-    /* Handle the case where this is the first node added */
-    if (!_xcwm_window_list_head) {
-        new_node->prev = NULL;
-        new_node->next = NULL;
-        _xcwm_window_list_head = new_node;
+    for (i = 0; i < old_size; i++) {
+        if (old_slots[i]) {
+            unsigned int slot =
+                window_table_hash(old_slots[i]->window_id, table->size);
+            while (table->slots[slot]) {
+                slot = (slot + 1) & (table->size - 1);
+            }
+            table->slots[slot] = old_slots[i];
+        }
+    }
+    free(old_slots);
+}
+
+static int
+window_table_find_slot(_xcwm_window_table const *table,
+                       xcb_window_t window_id)
+{
+    unsigned int slot;
+
+    if (!table->count) {
+        return -1;
     }
-    else {
-        /* Add the new node to the beginning of the list */
-        new_node->next = _xcwm_window_list_head;
-        _xcwm_window_list_head->prev = new_node;
-        new_node->prev = NULL;
-        _xcwm_window_list_head = new_node;
 
+    /* Table is never more than half full, so there is always an
+     * empty slot to stop the probe */
+    slot = window_table_hash(window_id, table->size);
+    while (table->slots[slot]) {
+        if (table->slots[slot]->window_id == window_id) {
+            return slot;
+        }
+        slot = (slot + 1) & (table->size - 1);
     }
-    return new_node->window;
+    return -1;
 }
 
 xcwm_window_t *
-_xcwm_get_window_node_by_window_id(xcb_window_t window_id)
+_xcwm_add_window(xcwm_window_t *window)
 {
-    _xcwm_window_node *curr;
+    _xcwm_window_table *table = &window->context->windows;
+    unsigned int slot;
 
-    curr = _xcwm_window_list_head;
-    while (curr) {
-        if (curr->window->window_id == window_id) {
-            return curr->window;
+    /* Keep the load factor at or below one half */
+    if ((table->count + 1) * 2 > table->size) {
+        window_table_grow(table);
+    }
+
+    slot = window_table_hash(window->window_id, table->size);
+    while (table->slots[slot]) {
+        if (table->slots[slot]->window_id == window->window_id) {
+            /* Already in the table, replace it */
+            table->slots[slot] = window;
+            return window;
         }
-        curr = curr->next;
+        slot = (slot + 1) & (table->size - 1);
     }
-    return NULL;
+    table->slots[slot] = window;
+    table->count++;
+
+    return window;
+}
+
+xcwm_window_t *
+_xcwm_get_window_node_by_window_id(xcwm_context_t *context,
+                                   xcb_window_t window_id)
+{
+    int slot = window_table_find_slot(&context->windows, window_id);
+
+    if (slot < 0) {
+        return NULL;
+    }
+    return context->windows.slots[slot];
 }
 
 void
-_xcwm_remove_window_node(xcb_window_t window_id)
+_xcwm_remove_window_node(xcwm_context_t *context, xcb_window_t window_id)
 {
+    _xcwm_window_table *table = &context->windows;
+    unsigned int hole;
+    unsigned int slot;
+    int found;
 
-    _xcwm_window_node *curr;
+    // the window itself will be freed in the event_loop
+    found = window_table_find_slot(table, window_id);
+    if (found < 0) {
+        return;
+    }
+    hole = found;
+    table->slots[hole] = NULL;
+    table->count--;
 
-    curr = _xcwm_window_list_head;
-    while (curr != NULL) {
-        if (curr->window->window_id == window_id) {
-            // this will be freed in the event_loop
-            if (curr->next) {
-                curr->next->prev = curr->prev;
-            }
-            if (curr->prev) {
-                curr->prev->next = curr->next;
-            }
-            else {
-                _xcwm_window_list_head = curr->next;
-            }
+    /* Backward-shift deletion: move any following entries of the
+     * probe run into the hole if that is closer to their home slot,
+     * so lookups never need tombstones */
+    slot = (hole + 1) & (table->size - 1);
+    while (table->slots[slot]) {
+        unsigned int home =
+            window_table_hash(table->slots[slot]->window_id, table->size);
 
-            free(curr);
-            return;
+        /* Distance from home to the current slot, and to the hole */
+        if (((slot - home) & (table->size - 1))
+            >= ((hole - home) & (table->size - 1))) {
+            table->slots[hole] = table->slots[slot];
+            table->slots[slot] = NULL;
+            hole = slot;
         }
-        else
-            curr = curr->next;
+        slot = (slot + 1) & (table->size - 1);
     }
-    return;
+}
+
+void
+_xcwm_window_table_clear(xcwm_context_t *context)
+{
+    free(context->windows.slots);
+    context->windows.slots = NULL;
+    context->windows.size = 0;
+    context->windows.count = 0;
 }
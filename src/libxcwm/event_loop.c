@@ -28,6 +28,8 @@
 #endif
 
 #include <pthread.h>
+#include <poll.h>
+#include <time.h>
 #include <xcwm/xcwm.h>
 #include <xcb/composite.h>
 #include "xcwm_internal.h"
@@ -38,68 +40,200 @@ struct xcwm_event_t {
     xcwm_event_type_t event_type;
 };
 
-/* Locally used data structure */
-typedef struct _connection_data {
-    xcwm_context_t *context;
-    xcwm_event_cb_t callback;
-} _connection_data;
-
-/* The thread that is running the event loop */
-pthread_t _event_thread = 0;
-
-pthread_mutex_t _event_thread_lock;
-
 /* Functions only called within event_loop.c */
+static void
+deliver(xcwm_context_t *context, xcwm_event_t const *event);
+
 void *
 run_event_loop(void *thread_arg_struct);
 
+/* Handle a single event received on the context's connection */
+static void
+process_event(xcwm_context_t *context, xcb_generic_event_t *evt);
+
+/* Note a change to the window, to be delivered at the end of the
+ * batch. Returns 1 if the change was merged with one already pending */
+static int
+pending_add(xcwm_context_t *context, xcwm_window_t *window, int kind);
+
+/* Note a change to a property of the window, to be handled at the end
+ * of the batch */
+static void
+pending_add_property(xcwm_context_t *context, xcwm_window_t *window,
+                     xcb_atom_t atom);
+
+/* Forget any changes pending for a window which is going away */
+static void
+pending_drop(xcwm_context_t *context, xcwm_window_t *window);
+
+/* Add the damage box reported by an event to a window. Returns 0 if
+ * the damage was replaced and no callback should be made */
+static int
+add_damage_box(xcwm_context_t *context, xcwm_window_t *window,
+               xcb_damage_notify_event_t *dmgevnt);
+
+/* Send the requests to fetch the exact damaged region of a locked
+ * window in exact damage mode, to be collected at the end of the
+ * batch */
+static int
+fetch_damage_request(xcwm_window_t *window);
+
+/* Collect the damaged regions fetched for a window */
+static void
+fetch_damage_collect(xcwm_window_t *window);
+
+/* Deliver all the changes pending at the end of a batch */
+static void
+pending_flush(xcwm_context_t *context);
+
+/* When held back damage may be delivered for a window */
+static uint64_t
+damage_due(xcwm_context_t *context, xcwm_window_t *window);
+
 /* Functions included in event.h */
 int
-xcwm_event_get_thread_lock(void)
+xcwm_event_get_thread_lock(xcwm_context_t *context)
 {
-    return pthread_mutex_lock(&_event_thread_lock);
+    return pthread_mutex_lock(&context->event_thread_lock);
 }
 
 int
-xcwm_event_release_thread_lock(void)
+xcwm_event_release_thread_lock(xcwm_context_t *context)
 {
-    return pthread_mutex_unlock(&_event_thread_lock);
+    return pthread_mutex_unlock(&context->event_thread_lock);
 }
 
 int
 xcwm_event_start_loop(xcwm_context_t *context,
                        xcwm_event_cb_t event_callback)
 {
-    _connection_data *conn_data;
     int ret_val;
-    int oldstate;
-
-    conn_data = malloc(sizeof(_connection_data));
-    assert(conn_data);
-
-    conn_data->context = context;
-    conn_data->callback = event_callback;
 
-    pthread_mutex_init(&_event_thread_lock, NULL);
+    context->event_callback = event_callback;
+    context->event_stop = 0;
 
-    ret_val = pthread_create(&_event_thread,
+    ret_val = pthread_create(&context->event_thread,
                              NULL,
                              run_event_loop,
-                             (void *)conn_data);
-
-    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &oldstate);
-    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, &oldstate);
+                             (void *)context);
 
     return ret_val;
 }
 
+void
+xcwm_event_set_callback(xcwm_context_t *context,
+                        xcwm_event_cb_t event_callback)
+{
+    context->event_callback = event_callback;
+}
+
+void
+xcwm_event_set_error_callback(xcwm_context_t *context,
+                              xcwm_error_cb_t error_callback)
+{
+    context->error_callback = error_callback;
+}
+
 int
-_xcwm_event_stop_loop(void)
+xcwm_context_dispatch(xcwm_context_t *context, int max_events)
 {
-    if (_event_thread) {
-        return pthread_cancel(_event_thread);
+    int count;
+
+    if (!context->event_prepared) {
+        _xcwm_event_loop_prepare(context);
+        context->event_prepared = 1;
     }
-    return 1;
+
+    count = _xcwm_event_drain(context, max_events, 0);
+
+    /* Send any requests made while handling the events */
+    xcb_flush(context->conn);
+
+    return count;
+}
+
+void
+xcwm_event_set_batching(xcwm_context_t *context, int enable)
+{
+    context->event_batching = enable;
+}
+
+void
+xcwm_event_set_frame_interval(xcwm_context_t *context,
+                              unsigned long interval_us)
+{
+    context->frame_interval = interval_us;
+}
+
+int
+xcwm_event_start_shared_loop(xcwm_context_t *context,
+                             xcwm_event_cb_t event_callback)
+{
+    context->event_callback = event_callback;
+
+    return _xcwm_reactor_add(context);
+}
+
+int
+_xcwm_event_stop_loop(xcwm_context_t *context)
+{
+    xcb_client_message_event_t event;
+    xcb_window_t window;
+    int ret_val;
+
+    if (context->event_shared) {
+        return _xcwm_reactor_remove(context);
+    }
+    if (!context->event_thread) {
+        return 0;
+    }
+
+    /* Ask the thread to stop, rather than cancelling it part way
+     * through an event, and wait for it, so nothing it uses is freed
+     * while it is running */
+    __atomic_store_n(&context->event_stop, 1, __ATOMIC_RELEASE);
+    if (pthread_equal(pthread_self(), context->event_thread)) {
+        return 1;
+    }
+
+    /* Wake it by sending ourselves an event. Sent with no event mask,
+     * it goes to the client which created the window. */
+    window = xcb_generate_id(context->conn);
+    xcb_create_window(context->conn, XCB_COPY_FROM_PARENT, window,
+                      context->root_window->window_id, 0, 0, 1, 1, 0,
+                      XCB_WINDOW_CLASS_INPUT_ONLY, XCB_COPY_FROM_PARENT,
+                      0, NULL);
+    memset(&event, 0, sizeof(xcb_client_message_event_t));
+    event.response_type = XCB_CLIENT_MESSAGE;
+    event.window = window;
+    event.format = 32;
+    xcb_send_event(context->conn, 0, window, XCB_EVENT_MASK_NO_EVENT,
+                   (char *)&event);
+    xcb_flush(context->conn);
+
+    ret_val = pthread_join(context->event_thread, NULL);
+    context->event_thread = 0;
+
+    xcb_destroy_window(context->conn, window);
+
+    return ret_val;
+}
+
+/* Hand an event to the client, through the event ring if there is one */
+static void
+deliver(xcwm_context_t *context, xcwm_event_t const *event)
+{
+    /* The type and opacity are only noted when they change */
+    if (event->window
+        && event->event_type == XCWM_EVENT_WINDOW_APPEARANCE) {
+        _xcwm_snapshot_window_changed(event->window, 1);
+    }
+
+    if (context->event_ring) {
+        _xcwm_event_ring_push(context, event->window, event->event_type);
+        return;
+    }
+    context->event_callback(event);
 }
 
 static void
@@ -113,19 +247,46 @@ _xcwm_window_composite_pixmap_release(xcwm_window_t *window)
 }
 
 static void
-_xcwm_window_composite_pixmap_update(xcwm_window_t *window)
+_xcwm_window_composite_pixmap_name(xcwm_window_t *window)
 {
   _xcwm_window_composite_pixmap_release(window);
   window->composite_pixmap_id = xcb_generate_id(window->context->conn);
   xcb_composite_name_window_pixmap(window->context->conn, window->window_id, window->composite_pixmap_id);
+  window->pixmap_width = window->bounds.width;
+  window->pixmap_height = window->bounds.height;
+  window->pixmap_border_width = window->border_width;
+  window->context->stats.pixmap_named++;
+}
+
+/*
+  The server only allocates a new pixmap for the window when it is
+  resized (or remapped), so a window which has only moved or been
+  restacked keeps the pixmap already named for it
+*/
+static void
+_xcwm_window_composite_pixmap_update(xcwm_window_t *window)
+{
+  if (window->composite_pixmap_id
+      && window->pixmap_width == window->bounds.width
+      && window->pixmap_height == window->bounds.height
+      && window->pixmap_border_width == window->border_width)
+    {
+      window->context->stats.pixmap_reused++;
+      return;
+    }
+
+  _xcwm_window_composite_pixmap_name(window);
 }
 
 /*
   Generate a XCWM_EVENT_WINDOW_CREATE event for all
   existing mapped top-level windows when we start
+
+  The requests for every window are sent before waiting for any of the
+  replies, so adopting any number of windows costs a few round trips.
 */
 static void
-_xcwm_windows_adopt(xcwm_context_t *context, xcwm_event_cb_t callback_ptr)
+_xcwm_windows_adopt(xcwm_context_t *context)
 {
     xcb_query_tree_cookie_t tree_cookie = xcb_query_tree(context->conn, context->root_window->window_id);
     xcb_query_tree_reply_t *reply = xcb_query_tree_reply(context->conn, tree_cookie, NULL);
@@ -135,11 +296,30 @@ _xcwm_windows_adopt(xcwm_context_t *context, xcwm_event_cb_t callback_ptr)
 
     int len = xcb_query_tree_children_length(reply);
     xcb_window_t *children = xcb_query_tree_children(reply);
+    xcb_get_window_attributes_cookie_t *cookies =
+        malloc(len * sizeof(xcb_get_window_attributes_cookie_t));
+    _xcwm_window_create_t *creates =
+        malloc(len * sizeof(_xcwm_window_create_t));
+    xcwm_window_t **windows = malloc(len * sizeof(xcwm_window_t *));
+    int num_creates = 0;
+    int num_windows = 0;
+
+    if (len && (!cookies || !creates || !windows)) {
+        free(cookies);
+        free(creates);
+        free(windows);
+        free(reply);
+        return;
+    }
 
     int i;
     for (i = 0; i < len; i ++) {
-        xcb_get_window_attributes_cookie_t cookie = xcb_get_window_attributes(context->conn, children[i]);
-        xcb_get_window_attributes_reply_t *attr = xcb_get_window_attributes_reply(context->conn, cookie, NULL);
+        cookies[i] = xcb_get_window_attributes(context->conn, children[i]);
+    }
+
+    /* Start creating all the viewable windows */
+    for (i = 0; i < len; i ++) {
+        xcb_get_window_attributes_reply_t *attr = xcb_get_window_attributes_reply(context->conn, cookies[i], NULL);
 
         if (!attr) {
             fprintf(stderr, "Couldn't get attributes for window 0x%08x\n", children[i]);
@@ -149,18 +329,11 @@ _xcwm_windows_adopt(xcwm_context_t *context, xcwm_event_cb_t callback_ptr)
         if (attr->map_state == XCB_MAP_STATE_VIEWABLE) {
             printf("window 0x%08x viewable\n", children[i]);
 
-            xcwm_window_t *window = _xcwm_window_create(context, children[i], context->root_window->window_id);
-            if (!window) {
-                continue;
+            if (_xcwm_window_create_begin(context, children[i],
+                                          context->root_window->window_id,
+                                          &creates[num_creates])) {
+                num_creates++;
             }
-
-            _xcwm_window_composite_pixmap_update(window);
-
-            xcwm_event_t return_evt;
-            return_evt.window = window;
-            return_evt.event_type = XCWM_EVENT_WINDOW_CREATE;
-
-            callback_ptr(&return_evt);
         }
         else {
             printf("window 0x%08x non-viewable\n", children[i]);
@@ -169,377 +342,934 @@ _xcwm_windows_adopt(xcwm_context_t *context, xcwm_event_cb_t callback_ptr)
         free(attr);
     }
 
+    /* Then finish them */
+    for (i = 0; i < num_creates; i++) {
+        xcwm_window_t *window = _xcwm_window_create_finish(&creates[i]);
+        if (!window) {
+            continue;
+        }
+
+        _xcwm_window_composite_pixmap_update(window);
+        windows[num_windows++] = window;
+    }
+
+    /* and tell the client about them all together */
+    for (i = 0; i < num_windows; i++) {
+        xcwm_event_t return_evt;
+        return_evt.window = windows[i];
+        return_evt.event_type = XCWM_EVENT_WINDOW_CREATE;
+
+        deliver(context, &return_evt);
+    }
+
+    free(cookies);
+    free(creates);
+    free(windows);
     free(reply);
 }
 
-void *
-run_event_loop(void *thread_arg_struct)
+static void
+process_event(xcwm_context_t *context, xcb_generic_event_t *evt)
 {
-    _connection_data *conn_data;
-    xcwm_context_t *context;
-    xcb_connection_t *event_conn;
-    xcb_generic_event_t *evt;
+    xcb_connection_t *event_conn = context->conn;
     xcwm_event_t return_evt;
-    xcwm_event_cb_t callback_ptr;
 
-    conn_data = thread_arg_struct;
-    context = conn_data->context;
-    event_conn = context->conn;
-    callback_ptr = conn_data->callback;
+    if (context->event_batching) {
+        context->batch_events++;
+    }
 
-    free(thread_arg_struct);
+    uint8_t response_type = evt->response_type  & ~0x80;
+    if (response_type == context->damage_event_mask) {
+        xcb_damage_notify_event_t *dmgevnt =
+            (xcb_damage_notify_event_t *)evt;
+        unsigned long damage_interval;
+        int damaged;
 
-    _xcwm_windows_adopt(context, callback_ptr);
+        /* printf("damage %d,%d @ %d,%d reported against window 0x%08x\n", */
+        /*        dmgevnt->area.width, dmgevnt->area.height, dmgevnt->area.x, dmgevnt->area.y, */
+        /*        dmgevnt->drawable); */
 
-    /* Start the event loop, and flush if first */
-    xcb_flush(event_conn);
+        xcwm_window_t *window =
+            _xcwm_get_window_node_by_window_id(context, dmgevnt->drawable);
 
-    while ((evt = xcb_wait_for_event(event_conn))) {
-        uint8_t response_type = evt->response_type  & ~0x80;
-        if (response_type == context->damage_event_mask) {
-            xcb_damage_notify_event_t *dmgevnt =
-                (xcb_damage_notify_event_t *)evt;
+        return_evt.event_type = XCWM_EVENT_WINDOW_DAMAGE;
+        return_evt.window = window;
 
-            /* printf("damage %d,%d @ %d,%d reported against window 0x%08x\n", */
-            /*        dmgevnt->area.width, dmgevnt->area.height, dmgevnt->area.x, dmgevnt->area.y, */
-            /*        dmgevnt->drawable); */
+        if (!window) {
+            printf("damage reported against unknown window 0x%08x\n", dmgevnt->drawable);
+            return;
+        }
 
-            xcwm_window_t *window = _xcwm_get_window_node_by_window_id(dmgevnt->drawable);
+        /* Only so many replies are left waiting, collect them if full.
+         * This waits, so isn't done with the window locked. */
+        if (window->num_dmg_fetches == _XCWM_DAMAGE_FETCHES) {
+            fetch_damage_collect(window);
+        }
 
-            return_evt.event_type = XCWM_EVENT_WINDOW_DAMAGE;
-            return_evt.window = window;
+        /* The client may change the damage mode, replacing the damage
+         * object, so keep it locked while using them */
+        xcwm_window_lock(window);
+        if (window->damage_mode == XCWM_DAMAGE_MODE_EXACT) {
+            /* The region is collected, and the damage delivered, at
+             * the end of the batch */
+            damaged = fetch_damage_request(window);
+        } else {
+            damaged = add_damage_box(context, window, dmgevnt);
+        }
+        damage_interval = window->damage_interval;
+        xcwm_window_unlock(window);
 
-            if (!window) {
-                printf("damage reported against unknown window 0x%08x\n", dmgevnt->drawable);
-                continue;
-            }
+        if (!damaged) {
+            return;
+        }
 
-            /* Increase the damaged area of window if new damage is
-             * larger than current. */
-            xcwm_event_get_thread_lock();
-
-            /* Initial damage events for override-redirect windows are
-             * reported relative to the root window, subsequent events
-             * are relative to the window itself. We also catch cases
-             * where the damage area is larger than the bounds of the
-             * window. */
-            if (window->initial_damage == 1
-                || (dmgevnt->area.width > window->bounds.width)
-                || (dmgevnt->area.height > window->bounds.height) ) {
-                xcb_xfixes_region_t region =
-                    xcb_generate_id(window->context->conn);
-                xcb_rectangle_t rect;
-
-                /* printf("initial damage on window 0x%08x\n", dmgevnt->drawable); */
-
-                /* Remove the damage */
-                xcb_xfixes_create_region(window->context->conn,
-                                         region,
-                                         1,
-                                         &dmgevnt->area);
-                xcb_damage_subtract(window->context->conn,
-                                    window->damage,
-                                    region,
-                                    XCB_NONE);
-
-                /* Add new damage area for entire window */
-                rect.x = 0;
-                rect.y = 0;
-                rect.width = window->bounds.width;
-                rect.height = window->bounds.height;
-                xcb_xfixes_set_region(window->context->conn,
-                                      region,
-                                      1,
-                                      &rect);
-                xcb_damage_add(window->context->conn,
-                               window->window_id,
-                               region);
-
-                window->initial_damage = 0;
-                xcb_xfixes_destroy_region(window->context->conn,
-                                          region);
-                xcwm_event_release_thread_lock();
-                continue;
+        /* Paced damage is held until the next frame */
+        if (context->event_batching || context->frame_interval
+            || damage_interval || window->num_dmg_fetches) {
+            if (pending_add(context, window, _XCWM_PENDING_DAMAGE)) {
+                if (context->frame_interval || damage_interval) {
+                    context->stats.redraws_saved++;
+                } else {
+                    context->stats.damage_merged++;
+                }
             }
+            return;
+        }
 
-            window->dmg_bounds.x = dmgevnt->area.x;
-            window->dmg_bounds.y = dmgevnt->area.y;
-            window->dmg_bounds.width = dmgevnt->area.width;
-            window->dmg_bounds.height = dmgevnt->area.height;
+        deliver(context, &return_evt);
 
-            xcwm_event_release_thread_lock();
+    }
+    else if (response_type == context->shape_event) {
+        xcb_shape_notify_event_t *shapeevnt =
+            (xcb_shape_notify_event_t *)evt;
 
-            callback_ptr(&return_evt);
+        if (shapeevnt->shape_kind == XCB_SHAPE_SK_BOUNDING) {
+            xcwm_window_t *window =
+                _xcwm_get_window_node_by_window_id(context,
+                                                   shapeevnt->affected_window);
+            _xcwm_window_set_shape(window, shapeevnt->shaped);
 
+            return_evt.event_type = XCWM_EVENT_WINDOW_SHAPE;
+            return_evt.window = window;
+            deliver(context, &return_evt);
         }
-        else if (response_type == context->shape_event) {
-            xcb_shape_notify_event_t *shapeevnt =
-                (xcb_shape_notify_event_t *)evt;
+    }
+    else if (response_type == context->fixes_event_base + XCB_XFIXES_CURSOR_NOTIFY) {
+        /* xcb_xfixes_cursor_notify_event_t *cursorevnt = */
+        /*     (xcb_xfixes_cursor_notify_event_t *)evt; */
 
-            if (shapeevnt->shape_kind == XCB_SHAPE_SK_BOUNDING) {
-                xcwm_window_t *window = _xcwm_get_window_node_by_window_id(shapeevnt->affected_window);
-                _xcwm_window_set_shape(window, shapeevnt->shaped);
+        return_evt.event_type = XCWM_EVENT_CURSOR;
+        return_evt.window = NULL;
+        deliver(context, &return_evt);
+    }
+    else {
+        switch (response_type) {
+        case 0:
+        {
+            /* Error case. Requests are not checked when they are
+             * made, so errors turn up here. If it was caused by a
+             * request we keep track of, tell the client which window
+             * and operation it was for. */
+            xcb_generic_error_t *err = (xcb_generic_error_t *)evt;
+            _xcwm_tracked_request request;
+            xcwm_window_t *window = NULL;
+
+            context->stats.errors++;
+
+            if (_xcwm_request_find(context, err, &request)) {
+                window = _xcwm_get_window_node_by_window_id(context,
+                                                            request.window);
+
+                /* The window has no damage object, so no damage requests
+                 * are sent for it */
+                if (window && request.op == XCWM_ERROR_OP_DAMAGE_CREATE) {
+                    xcwm_window_lock(window);
+                    if (window->damage == request.resource) {
+                        window->damage = 0;
+                    }
+                    xcwm_window_unlock(window);
+                }
+            } else {
+                request.op = XCWM_ERROR_OP_UNKNOWN;
+            }
 
-                return_evt.event_type = XCWM_EVENT_WINDOW_SHAPE;
-                return_evt.window = window;
-                callback_ptr(&return_evt);
+            if (context->error_callback) {
+                context->error_callback(context, window, request.op,
+                                        err->error_code);
+                break;
             }
+
+            /* Otherwise spit out some hopefully useful information */
+            fprintf(stderr, "Error received in event loop.\n"
+                    "Error code: %i\n"
+                    "Request: %i.%i, sequence %i\n",
+                    err->error_code, err->major_code, err->minor_code,
+                    err->sequence);
+            if ((err->error_code >= XCB_VALUE)
+                && (err->error_code <= XCB_FONT)) {
+                xcb_value_error_t *val_err = (xcb_value_error_t *)evt;
+                fprintf(stderr, "Bad value: %i\n"
+                        "Major opcode: %i\n"
+                        "Minor opcode: %i\n",
+                        val_err->bad_value,
+                        val_err->major_opcode,
+                        val_err->minor_opcode);
+            }
+            break;
         }
-        else if (response_type == context->fixes_event_base + XCB_XFIXES_CURSOR_NOTIFY) {
-            /* xcb_xfixes_cursor_notify_event_t *cursorevnt = */
-            /*     (xcb_xfixes_cursor_notify_event_t *)evt; */
 
-            return_evt.event_type = XCWM_EVENT_CURSOR;
-            return_evt.window = NULL;
-            callback_ptr(&return_evt);
+        case XCB_EXPOSE:
+        {
+            xcb_expose_event_t *exevnt = (xcb_expose_event_t *)evt;
+
+            printf(
+                "Window %u exposed. Region to be redrawn at location (%d, %d), ",
+                exevnt->window, exevnt->x, exevnt->y);
+            printf("with dimensions (%d, %d).\n", exevnt->width,
+                   exevnt->height);
+
+            return_evt.event_type = XCWM_EVENT_WINDOW_EXPOSE;
+            return_evt.window =
+                _xcwm_get_window_node_by_window_id(context, exevnt->window);
+            deliver(context, &return_evt);
+            break;
         }
-        else {
-            switch (response_type) {
-            case 0:
-            {
-                /* Error case. Something very bad has happened. Spit
-                 * out some hopefully useful information and then
-                 * die.
-                 * FIXME: Decide under what circumstances we should
-                 * acutally kill the application. */
-                xcb_generic_error_t *err = (xcb_generic_error_t *)evt;
-                fprintf(stderr, "Error received in event loop.\n"
-                        "Error code: %i\n",
-                        err->error_code);
-                if ((err->error_code >= XCB_VALUE)
-                    && (err->error_code <= XCB_FONT)) {
-                    xcb_value_error_t *val_err = (xcb_value_error_t *)evt;
-                    fprintf(stderr, "Bad value: %i\n"
-                            "Major opcode: %i\n"
-                            "Minor opcode: %i\n",
-                            val_err->bad_value,
-                            val_err->major_opcode,
-                            val_err->minor_opcode);
-                }
-                break;
-            }
 
-            case XCB_EXPOSE:
-            {
-                xcb_expose_event_t *exevnt = (xcb_expose_event_t *)evt;
+        case XCB_CREATE_NOTIFY:
+        {
+            /* We don't actually allow our client to create its
+             * window here, wait until the XCB_MAP_REQUEST */
+            break;
+        }
 
-                printf(
-                    "Window %u exposed. Region to be redrawn at location (%d, %d), ",
-                    exevnt->window, exevnt->x, exevnt->y);
-                printf("with dimensions (%d, %d).\n", exevnt->width,
-                       exevnt->height);
+        case XCB_DESTROY_NOTIFY:
+        {
+            // Window destroyed in root window
+            xcb_destroy_notify_event_t *notify =
+                (xcb_destroy_notify_event_t *)evt;
+            xcwm_window_t *window =
+                _xcwm_window_remove(context, notify->window);
 
-                return_evt.event_type = XCWM_EVENT_WINDOW_EXPOSE;
-                callback_ptr(&return_evt);
+            if (!window) {
+                /* Not a window in the list, don't try and destroy */
                 break;
             }
 
-            case XCB_CREATE_NOTIFY:
-            {
-                /* We don't actually allow our client to create its
-                 * window here, wait until the XCB_MAP_REQUEST */
-                break;
-            }
+            pending_drop(context, window);
 
-            case XCB_DESTROY_NOTIFY:
-            {
-                // Window destroyed in root window
-                xcb_destroy_notify_event_t *notify =
-                    (xcb_destroy_notify_event_t *)evt;
-                xcwm_window_t *window =
-                    _xcwm_window_remove(event_conn, notify->window);
-
-                if (!window) {
-                    /* Not a window in the list, don't try and destroy */
-                    break;
-                }
+            return_evt.event_type = XCWM_EVENT_WINDOW_DESTROY;
+            return_evt.window = window;
 
-                return_evt.event_type = XCWM_EVENT_WINDOW_DESTROY;
-                return_evt.window = window;
+            deliver(context, &return_evt);
+
+            // Release memory for the window
+            _xcwm_window_release(window);
+            break;
+        }
 
-                callback_ptr(&return_evt);
+        case XCB_MAP_NOTIFY:
+        {
+            xcb_map_notify_event_t *notify =
+                (xcb_map_notify_event_t *)evt;
 
-                // Release memory for the window
-                _xcwm_window_release(window);
-                break;
-            }
+            /* notify->event holds parent of the window */
 
-            case XCB_MAP_NOTIFY:
+            xcwm_window_t *window =
+                _xcwm_get_window_node_by_window_id(context, notify->window);
+            if (!window)
             {
-                xcb_map_notify_event_t *notify =
-                    (xcb_map_notify_event_t *)evt;
-
-                /* notify->event holds parent of the window */
+                /*
+                  No MAP_REQUEST for override-redirect windows, so
+                  need to create the xcwm_window_t for it now
+                */
+                /* printf("MAP_NOTIFY without MAP_REQUEST\n"); */
+                window =
+                    _xcwm_window_create(context, notify->window,
+                                        notify->event);
 
-                xcwm_window_t *window =
-                    _xcwm_get_window_node_by_window_id(notify->window);
-                if (!window)
-                {
-                    /*
-                      No MAP_REQUEST for override-redirect windows, so
-                      need to create the xcwm_window_t for it now
-                    */
-                    /* printf("MAP_NOTIFY without MAP_REQUEST\n"); */
-                    window =
-                        _xcwm_window_create(context, notify->window,
-                                            notify->event);
-
-                    if (window)
-                    {
-                        _xcwm_window_composite_pixmap_update(window);
-
-                        return_evt.window = window;
-                        return_evt.event_type = XCWM_EVENT_WINDOW_CREATE;
-                        callback_ptr(&return_evt);
-                    }
-                }
-                else
+                if (window)
                 {
                     _xcwm_window_composite_pixmap_update(window);
+
+                    return_evt.window = window;
+                    return_evt.event_type = XCWM_EVENT_WINDOW_CREATE;
+                    deliver(context, &return_evt);
                 }
+            }
+            else
+            {
+                _xcwm_window_composite_pixmap_name(window);
+            }
+
+            break;
+        }
 
+        case XCB_MAP_REQUEST:
+        {
+            xcb_map_request_event_t *request =
+                (xcb_map_request_event_t *)evt;
+
+            /* Map the window */
+            xcb_map_window(context->conn, request->window);
+            xcb_flush(context->conn);
+
+            return_evt.window =
+                _xcwm_window_create(context, request->window,
+                                    request->parent);
+            if (!return_evt.window) {
                 break;
             }
 
-            case XCB_MAP_REQUEST:
-            {
-                xcb_map_request_event_t *request =
-                    (xcb_map_request_event_t *)evt;
-
-                /* Map the window */
-                xcb_map_window(context->conn, request->window);
-                xcb_flush(context->conn);
-
-                return_evt.window =
-                    _xcwm_window_create(context, request->window,
-                                        request->parent);
-                if (!return_evt.window) {
-                    break;
-                }
+            return_evt.event_type = XCWM_EVENT_WINDOW_CREATE;
+            deliver(context, &return_evt);
+            break;
+        }
 
-                return_evt.event_type = XCWM_EVENT_WINDOW_CREATE;
-                callback_ptr(&return_evt);
+        case XCB_UNMAP_NOTIFY:
+        {
+            xcb_unmap_notify_event_t *notify =
+                (xcb_unmap_notify_event_t *)evt;
+
+            xcwm_window_t *window =
+                _xcwm_window_remove(context, notify->window);
+
+            if (!window) {
+                /* Not a window in the list, don't try and destroy */
                 break;
             }
 
-            case XCB_UNMAP_NOTIFY:
-            {
-                xcb_unmap_notify_event_t *notify =
-                    (xcb_unmap_notify_event_t *)evt;
+            pending_drop(context, window);
+
+            return_evt.event_type = XCWM_EVENT_WINDOW_DESTROY;
+            return_evt.window = window;
 
-                xcwm_window_t *window =
-                    _xcwm_window_remove(event_conn, notify->window);
+            deliver(context, &return_evt);
 
-                if (!window) {
-                    /* Not a window in the list, don't try and destroy */
-                    break;
-                }
+            _xcwm_window_composite_pixmap_release(window);
 
-                return_evt.event_type = XCWM_EVENT_WINDOW_DESTROY;
-                return_evt.window = window;
+            // Release memory for the window
+            _xcwm_window_release(window);
+            break;
+        }
 
-                callback_ptr(&return_evt);
+        case XCB_CONFIGURE_NOTIFY:
+        {
+            xcb_configure_notify_event_t *request =
+                (xcb_configure_notify_event_t *)evt;
 
-                _xcwm_window_composite_pixmap_release(window);
+            printf("CONFIGURE_NOTIFY: XID 0x%08x %dx%d @ %d,%d\n",
+                   request->window, request->width, request->height,
+                   request->x, request->y);
 
-                // Release memory for the window
-                _xcwm_window_release(window);
+            xcwm_window_t *window =
+                _xcwm_get_window_node_by_window_id(context, request->window);
+            if (!window)
+                break;
+
+            /* Keep the geometry cache exact */
+            xcwm_window_lock(window);
+            window->bounds.x = request->x;
+            window->bounds.y = request->y;
+            window->bounds.width = request->width;
+            window->bounds.height = request->height;
+            window->border_width = request->border_width;
+            window->above_sibling = request->above_sibling;
+            _xcwm_snapshot_window_changed(window, 0);
+            xcwm_window_unlock(window);
+            _xcwm_stacking_restack(window, request->above_sibling);
+
+            if (context->event_batching) {
+                if (pending_add(context, window, _XCWM_PENDING_CONFIGURE)) {
+                    context->stats.configure_merged++;
+                }
                 break;
             }
+            _xcwm_window_composite_pixmap_update(window);
+            break;
+        }
 
-            case XCB_CONFIGURE_NOTIFY:
+        case XCB_CONFIGURE_REQUEST:
+        {
+            xcb_configure_request_event_t *request =
+                (xcb_configure_request_event_t *)evt;
+
+            printf("CONFIGURE_REQUEST: XID 0x%08x %dx%d @ %d,%d mask 0x%04x\n",
+                   request->window, request->width, request->height,
+                   request->x, request->y, request->value_mask);
+
+            /*
+               relying on the server's idea of the current values of values not
+               in value_mask is a bad idea, we might have a configure request of
+               our own on this window in flight
+            */
+            if (request->value_mask &
+                (XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y | XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT))
             {
-                xcb_configure_notify_event_t *request =
-                    (xcb_configure_notify_event_t *)evt;
+                _xcwm_resize_window(context, request->window,
+                                    request->x, request->y,
+                                    request->width, request->height);
+                xcb_flush(event_conn);
+            }
 
-                printf("CONFIGURE_NOTIFY: XID 0x%08x %dx%d @ %d,%d\n",
-                       request->window, request->width, request->height,
-                       request->x, request->y);
+            /* Ignore requests to change stacking ? */
 
-                xcwm_window_t *window =
-                    _xcwm_get_window_node_by_window_id(request->window);
-                if (window)
-                    _xcwm_window_composite_pixmap_update(window);
+            break;
+        }
+
+        case XCB_PROPERTY_NOTIFY:
+        {
+            xcb_property_notify_event_t *notify =
+                (xcb_property_notify_event_t *)evt;
+            xcwm_window_t *window =
+                _xcwm_get_window_node_by_window_id(context, notify->window);
+            if (!window) {
                 break;
             }
 
-            case XCB_CONFIGURE_REQUEST:
-            {
-                xcb_configure_request_event_t *request =
-                    (xcb_configure_request_event_t *)evt;
+            /* Properties are refetched once at the end of the batch */
+            if (context->event_batching) {
+                pending_add_property(context, window, notify->atom);
+                break;
+            }
 
-                printf("CONFIGURE_REQUEST: XID 0x%08x %dx%d @ %d,%d mask 0x%04x\n",
-                       request->window, request->width, request->height,
-                       request->x, request->y, request->value_mask);
+            /* If this is WM_PROTOCOLS, do not send event, just
+             * handle internally */
+            if (notify->atom == window->context->atoms.ewmh_conn.WM_PROTOCOLS) {
+                _xcwm_atoms_set_wm_delete(window);
+                break;
+            }
 
+            xcwm_event_type_t event;
+            if (_xcwm_atom_change_to_event(notify->atom, window, &event))
+            {
+                /* Send the appropriate event */
+                return_evt.event_type = event;
+                return_evt.window = window;
+                deliver(context, &return_evt);
+            }
+            else {
+                printf("PROPERTY_NOTIFY for ignored property atom %d\n", notify->atom);
                 /*
-                   relying on the server's idea of the current values of values not
-                   in value_mask is a bad idea, we might have a configure request of
-                   our own on this window in flight
+                  We need a mechanism to forward properties we don't know about to WM,
+                  otherwise everything needs to be in libXcwm ...?
                 */
-                if (request->value_mask &
-                    (XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y | XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT))
-                    _xcwm_resize_window(event_conn, request->window,
-                                        request->x, request->y,
-                                        request->width, request->height);
+            }
 
-                /* Ignore requests to change stacking ? */
+            break;
+        }
 
-                break;
+        case XCB_MAPPING_NOTIFY:
+            break;
+
+        case XCB_CLIENT_MESSAGE:
+            /* Sent to wake the event loop, see _xcwm_event_stop_loop() */
+            break;
+
+        default:
+        {
+            printf("UNKNOWN EVENT: %i\n", (evt->response_type & ~0x80));
+            break;
+        }
+        }
+    }
+}
+
+void
+_xcwm_event_loop_prepare(xcwm_context_t *context)
+{
+    _xcwm_windows_adopt(context);
+    _xcwm_snapshot_publish(context);
+
+    /* Start the event loop, and flush if first */
+    xcb_flush(context->conn);
+}
+
+static int
+add_damage_box(xcwm_context_t *context, xcwm_window_t *window,
+               xcb_damage_notify_event_t *dmgevnt)
+{
+    xcwm_rect_t area;
+
+    xcwm_window_lock(window);
+
+    /* Initial damage events for override-redirect windows are
+     * reported relative to the root window, subsequent events
+     * are relative to the window itself. We also catch cases
+     * where the damage area is larger than the bounds of the
+     * window. */
+    if (window->initial_damage == 1
+        || (dmgevnt->area.width > window->bounds.width)
+        || (dmgevnt->area.height > window->bounds.height) ) {
+        xcb_xfixes_region_t region =
+            xcb_generate_id(context->conn);
+        xcb_rectangle_t rect;
+
+        /* printf("initial damage on window 0x%08x\n", dmgevnt->drawable); */
+
+        /* Remove the damage */
+        xcb_xfixes_create_region(context->conn,
+                                 region,
+                                 1,
+                                 &dmgevnt->area);
+        if (window->damage) {
+            xcb_damage_subtract(context->conn,
+                                window->damage,
+                                region,
+                                XCB_NONE);
+        }
+
+        /* Add new damage area for entire window */
+        rect.x = 0;
+        rect.y = 0;
+        rect.width = window->bounds.width;
+        rect.height = window->bounds.height;
+        xcb_xfixes_set_region(context->conn,
+                              region,
+                              1,
+                              &rect);
+        xcb_damage_add(context->conn,
+                       window->window_id,
+                       region);
+
+        window->initial_damage = 0;
+        xcb_xfixes_destroy_region(context->conn,
+                                  region);
+        xcwm_window_unlock(window);
+        return 0;
+    }
+
+    /* Accumulate the new damage with any not yet removed, within the
+     * window, as the box can lie partly outside it */
+    area.x = dmgevnt->area.x;
+    area.y = dmgevnt->area.y;
+    area.width = dmgevnt->area.width;
+    area.height = dmgevnt->area.height;
+    if (!_xcwm_rect_clip(&area, window->bounds.width,
+                         window->bounds.height)) {
+        xcwm_window_unlock(window);
+        return 0;
+    }
+    _xcwm_region_union_rect(&window->dmg_region, &area);
+    _xcwm_window_note_damage(window, (long)area.width * area.height,
+                             _xcwm_time_us());
+    _xcwm_snapshot_window_changed(window, 0);
+
+    xcwm_window_unlock(window);
+
+    return 1;
+}
+
+/* Send the requests to fetch the window's damage. Returns 0 if the
+ * window has no damage object. */
+static int
+fetch_damage_request(xcwm_window_t *window)
+{
+    xcb_connection_t *conn = window->context->conn;
+
+    if (!window->damage) {
+        return 0;
+    }
+
+    /* Move all the damage into our region, which also re-arms the
+     * damage object to report the next change, and fetch the
+     * rectangles in it. The server handles requests in order, so each
+     * fetch gets the damage moved by the subtract before it. */
+    xcb_damage_subtract(conn, window->damage, XCB_NONE, window->dmg_parts);
+    window->dmg_fetches[window->num_dmg_fetches++] =
+        xcb_xfixes_fetch_region(conn, window->dmg_parts);
+
+    return 1;
+}
+
+static void
+fetch_damage_collect(xcwm_window_t *window)
+{
+    xcb_connection_t *conn = window->context->conn;
+    xcb_xfixes_fetch_region_reply_t *reply;
+    xcb_rectangle_t *rects;
+    xcwm_rect_t area;
+    long damaged;
+    int num_rects;
+    int i;
+    int j;
+
+    /* The replies are waited for without the window locked */
+    for (j = 0; j < window->num_dmg_fetches; j++) {
+        reply = xcb_xfixes_fetch_region_reply(conn, window->dmg_fetches[j],
+                                              NULL);
+        if (!reply) {
+            continue;
+        }
+        rects = xcb_xfixes_fetch_region_rectangles(reply);
+        num_rects = xcb_xfixes_fetch_region_rectangles_length(reply);
+        damaged = 0;
+
+        xcwm_window_lock(window);
+
+        /* Initial damage for override-redirect windows is relative to
+         * the root window, see below, so just damage the whole window */
+        if (window->initial_damage) {
+            area.x = 0;
+            area.y = 0;
+            area.width = window->bounds.width;
+            area.height = window->bounds.height;
+            _xcwm_region_union_rect(&window->dmg_region, &area);
+            damaged = (long)area.width * area.height;
+            window->initial_damage = 0;
+            num_rects = 0;
+        }
+
+        for (i = 0; i < num_rects; i++) {
+            /* Clip to the window */
+            area.x = rects[i].x;
+            area.y = rects[i].y;
+            area.width = rects[i].width;
+            area.height = rects[i].height;
+            if (_xcwm_rect_clip(&area, window->bounds.width,
+                                window->bounds.height)) {
+                _xcwm_region_union_rect(&window->dmg_region, &area);
+                damaged += (long)area.width * area.height;
             }
+        }
+        _xcwm_window_note_damage(window, damaged, _xcwm_time_us());
+        _xcwm_snapshot_window_changed(window, 0);
 
-            case XCB_PROPERTY_NOTIFY:
-            {
-                xcb_property_notify_event_t *notify =
-                    (xcb_property_notify_event_t *)evt;
-                xcwm_window_t *window =
-                    _xcwm_get_window_node_by_window_id(notify->window);
-                if (!window) {
-                    break;
-                }
+        xcwm_window_unlock(window);
 
-                /* If this is WM_PROTOCOLS, do not send event, just
-                 * handle internally */
-                if (notify->atom == window->context->atoms.ewmh_conn.WM_PROTOCOLS) {
-                    _xcwm_atoms_set_wm_delete(window);
-                    break;
-                }
+        free(reply);
+    }
+    window->num_dmg_fetches = 0;
+}
 
-                xcwm_event_type_t event;
-                if (_xcwm_atom_change_to_event(notify->atom, window, &event))
-                {
-                    /* Send the appropriate event */
-                    return_evt.event_type = event;
-                    return_evt.window = window;
-                    callback_ptr(&return_evt);
-                }
-                else {
-                    printf("PROPERTY_NOTIFY for ignored property atom %d\n", notify->atom);
-                    /*
-                      We need a mechanism to forward properties we don't know about to WM,
-                      otherwise everything needs to be in libXcwm ...?
-                    */
+static int
+pending_add(xcwm_context_t *context, xcwm_window_t *window, int kind)
+{
+    if (window->pending & kind) {
+        context->batch_merged++;
+        return 1;
+    }
+
+    if (!window->pending) {
+        if (context->num_pending_windows == context->max_pending_windows) {
+            if (context->max_pending_windows) {
+                context->max_pending_windows *= 2;
+            } else {
+                context->max_pending_windows = 16;
+            }
+            context->pending_windows =
+                realloc(context->pending_windows,
+                        context->max_pending_windows
+                        * sizeof(xcwm_window_t *));
+            assert(context->pending_windows);
+        }
+        context->pending_windows[context->num_pending_windows++] = window;
+    }
+    window->pending |= kind;
+
+    return 0;
+}
+
+static void
+pending_add_property(xcwm_context_t *context, xcwm_window_t *window,
+                     xcb_atom_t atom)
+{
+    int i;
+
+    context->batch_property_events++;
+
+    /* Only the latest value of a property is of interest, so only
+     * note each atom once */
+    if (window->pending & _XCWM_PENDING_PROPERTY) {
+        for (i = 0; i < window->num_pending_atoms; i++) {
+            if (window->pending_atoms[i] == atom) {
+                context->batch_merged++;
+                context->stats.property_merged++;
+                return;
+            }
+        }
+    } else {
+        pending_add(context, window, _XCWM_PENDING_PROPERTY);
+    }
+
+    if (window->num_pending_atoms == window->max_pending_atoms) {
+        if (window->max_pending_atoms) {
+            window->max_pending_atoms *= 2;
+        } else {
+            window->max_pending_atoms = 4;
+        }
+        window->pending_atoms =
+            realloc(window->pending_atoms,
+                    window->max_pending_atoms * sizeof(xcb_atom_t));
+        assert(window->pending_atoms);
+    }
+    window->pending_atoms[window->num_pending_atoms++] = atom;
+}
+
+static void
+pending_drop(xcwm_context_t *context, xcwm_window_t *window)
+{
+    int i;
+
+    if (!window->pending) {
+        return;
+    }
+
+    /* Nobody is going to collect these */
+    for (i = 0; i < window->num_dmg_fetches; i++) {
+        xcb_discard_reply(context->conn, window->dmg_fetches[i].sequence);
+    }
+    window->num_dmg_fetches = 0;
+
+    for (i = 0; i < context->num_pending_windows; i++) {
+        if (context->pending_windows[i] == window) {
+            context->num_pending_windows--;
+            memmove(&context->pending_windows[i],
+                    &context->pending_windows[i + 1],
+                    (context->num_pending_windows - i)
+                    * sizeof(xcwm_window_t *));
+            break;
+        }
+    }
+    window->pending = 0;
+    window->num_pending_atoms = 0;
+}
+
+static void
+pending_flush(xcwm_context_t *context)
+{
+    xcwm_event_t return_evt;
+    struct _xcwm_atoms_request **requests = NULL;
+    unsigned long property_events = 0;
+    uint64_t now = _xcwm_time_us();
+    int frame_used = 0;
+    int num_held = 0;
+    int i;
+    int j;
+
+    /* Send the requests for all the changed properties of all the
+     * windows before waiting for any replies, so refetching them costs
+     * one round trip */
+    for (i = 0; i < context->num_pending_windows; i++) {
+        xcwm_window_t *window = context->pending_windows[i];
+
+        if (!(window->pending & _XCWM_PENDING_PROPERTY)) {
+            continue;
+        }
+        if (!requests) {
+            requests = calloc(context->num_pending_windows,
+                              sizeof(struct _xcwm_atoms_request *));
+            assert(requests);
+        }
+        requests[i] = _xcwm_atoms_request_changes(window,
+                                                  window->pending_atoms,
+                                                  window->num_pending_atoms);
+        window->num_pending_atoms = 0;
+    }
+
+    for (i = 0; i < context->num_pending_windows; i++) {
+        xcwm_window_t *window = context->pending_windows[i];
+        int pending = window->pending;
+
+        window->pending = 0;
+        return_evt.window = window;
+
+        /* Damage fetched in exact damage mode */
+        if (window->num_dmg_fetches) {
+            fetch_damage_collect(window);
+        }
+
+        if (pending & _XCWM_PENDING_CONFIGURE) {
+            _xcwm_window_composite_pixmap_update(window);
+        }
+
+        if (pending & _XCWM_PENDING_PROPERTY) {
+            /* Send each resulting event type once */
+            uint32_t events = _xcwm_atoms_reply_changes(window, requests[i]);
+
+            for (j = 0; events; j++) {
+                if (events & (1 << j)) {
+                    events &= ~(1 << j);
+                    return_evt.event_type = j;
+                    deliver(context, &return_evt);
+                    property_events++;
                 }
+            }
+        }
 
-                break;
+        if (pending & _XCWM_PENDING_DAMAGE) {
+            /* With frame pacing or a limit on the window's rate,
+             * damage is held pending until it is due */
+            if (now < damage_due(context, window)) {
+                window->pending = _XCWM_PENDING_DAMAGE;
+                context->pending_windows[num_held++] = window;
+                continue;
             }
+            return_evt.event_type = XCWM_EVENT_WINDOW_DAMAGE;
+            deliver(context, &return_evt);
 
-            case XCB_MAPPING_NOTIFY:
-                break;
+            xcwm_window_lock(window);
+            window->next_damage = now + window->damage_interval;
+            xcwm_window_unlock(window);
+            frame_used = 1;
+        }
+    }
+    context->num_pending_windows = num_held;
 
-            default:
-            {
-                printf("UNKNOWN EVENT: %i\n", (evt->response_type & ~0x80));
+    /* This frame has been used */
+    if (frame_used && context->frame_interval) {
+        context->next_frame = now + context->frame_interval;
+    }
+    free(requests);
+
+    if (context->batch_property_events >= property_events) {
+        context->stats.property_suppressed +=
+            context->batch_property_events - property_events;
+    }
+    context->batch_property_events = 0;
+
+    if (context->batch_events) {
+        context->stats.batches++;
+        context->stats.batch_events += context->batch_events;
+        context->stats.last_batch_events = context->batch_events;
+        context->stats.last_batch_merged = context->batch_merged;
+        context->batch_events = 0;
+        context->batch_merged = 0;
+    }
+}
+
+int
+_xcwm_event_drain(xcwm_context_t *context, int max_events, int queued_only)
+{
+    xcb_generic_event_t *evt;
+    int count = 0;
+
+    while (max_events <= 0 || count < max_events) {
+        if (queued_only) {
+            evt = xcb_poll_for_queued_event(context->conn);
+        } else {
+            evt = xcb_poll_for_event(context->conn);
+        }
+        if (!evt) {
+            break;
+        }
+        process_event(context, evt);
+        free(evt);
+        count++;
+    }
+
+    /* Also deliver any damage held back if pacing has been turned off */
+    if (context->event_batching || context->frame_interval
+        || context->num_pending_windows) {
+        pending_flush(context);
+    }
+    _xcwm_snapshot_publish(context);
+
+    /* Nothing refers to replaced property tables between events */
+    _xcwm_atoms_reclaim(context);
+
+    if (xcb_connection_has_error(context->conn)) {
+        return -1;
+    }
+    return count;
+}
+
+void *
+run_event_loop(void *thread_arg_struct)
+{
+    xcwm_context_t *context = thread_arg_struct;
+    xcb_generic_event_t *evt;
+
+    _xcwm_event_loop_prepare(context);
+
+    while (!__atomic_load_n(&context->event_stop, __ATOMIC_ACQUIRE)) {
+        /* Wait with a timeout while damage is held back */
+        if (context->frame_interval || context->num_pending_windows) {
+            struct pollfd pfd;
+            int count;
+
+            /* Handle everything already received, including anything
+             * read while doing so, then wait for more events or for
+             * the next frame */
+            while ((count = _xcwm_event_drain(context, 0, 1)) > 0);
+            if (count < 0) {
                 break;
             }
+            xcb_flush(context->conn);
+
+            pfd.fd = xcb_get_file_descriptor(context->conn);
+            pfd.events = POLLIN;
+            poll(&pfd, 1, _xcwm_event_timeout(context));
+
+            if (_xcwm_event_drain(context, 0, 0) < 0) {
+                break;
             }
+            continue;
         }
-        /* Free the event */
+
+        evt = xcb_wait_for_event(context->conn);
+        if (!evt) {
+            break;
+        }
+        process_event(context, evt);
         free(evt);
+
+        /* Handle everything else already received, as one batch if
+         * batching, and deliver any changes pending */
+        _xcwm_event_drain(context, 0, 1);
     }
     return NULL;
 }
 
+static uint64_t
+damage_due(xcwm_context_t *context, xcwm_window_t *window)
+{
+    uint64_t due = 0;
+
+    if (context->frame_interval) {
+        due = context->next_frame;
+    }
+
+    /* The client may change the window's limit */
+    xcwm_window_lock(window);
+    if (window->damage_interval && window->next_damage > due) {
+        due = window->next_damage;
+    }
+    xcwm_window_unlock(window);
+
+    return due;
+}
+
+int
+_xcwm_event_timeout(xcwm_context_t *context)
+{
+    uint64_t now;
+    uint64_t due = 0;
+    int i;
+
+    /* Nothing held back. Between batches, only damage waiting for its
+     * frame is pending. */
+    if (!context->num_pending_windows) {
+        return -1;
+    }
+
+    for (i = 0; i < context->num_pending_windows; i++) {
+        uint64_t window_due = damage_due(context,
+                                         context->pending_windows[i]);
+
+        if (i == 0 || window_due < due) {
+            due = window_due;
+        }
+    }
+
+    now = _xcwm_time_us();
+    if (now >= due) {
+        return 0;
+    }
+
+    /* Round up, so we don't wake just before the frame is due */
+    return (due - now + 999) / 1000;
+}
+
 xcwm_event_type_t
 xcwm_event_get_type(xcwm_event_t const *event)
 {
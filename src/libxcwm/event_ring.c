@@ -0,0 +1,179 @@
+/* Copyright (c) 2013 The libxcwm authors
+ *
+ * event_ring.c
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <xcwm/xcwm.h>
+#include "xcwm_internal.h"
+
+/*
+  The event ring: records are written only by the event loop thread and
+  read only by the client's consumer thread. Each side only ever stores
+  its own index, so no lock is needed. The producer publishes a record
+  by storing head with release semantics after writing it, and the
+  consumer frees a slot by storing tail after reading it.
+
+  Each record holds a reference to its window, which the consumer drops
+  once done with it, so the window can't be freed before then.
+ */
+
+/* Free a ring, dropping the references held by records never taken */
+static void
+ring_free(_xcwm_event_ring *ring)
+{
+    unsigned int tail;
+
+    for (tail = ring->tail; tail != ring->head; tail++) {
+        xcwm_event_record_t *record = &ring->records[tail & ring->mask];
+
+        if (record->window) {
+            xcwm_window_unref(record->window);
+        }
+    }
+
+    free(ring->records);
+    free(ring);
+}
+
+int
+xcwm_event_set_ring(xcwm_context_t *context, unsigned int size)
+{
+    _xcwm_event_ring *ring;
+    unsigned int slots = 1;
+
+    if (context->event_thread || context->event_shared
+        || context->event_prepared) {
+        return 1;
+    }
+
+    ring = context->event_ring;
+    context->event_ring = NULL;
+    if (ring) {
+        ring_free(ring);
+    }
+
+    if (!size) {
+        return 0;
+    }
+
+    /* Indexes are reduced with a mask */
+    while (slots < size) {
+        slots <<= 1;
+    }
+
+    ring = malloc(sizeof(_xcwm_event_ring));
+    if (!ring) {
+        return 1;
+    }
+    ring->records = malloc(slots * sizeof(xcwm_event_record_t));
+    if (!ring->records) {
+        free(ring);
+        return 1;
+    }
+    ring->mask = slots - 1;
+    ring->head = 0;
+    ring->tail = 0;
+
+    context->event_ring = ring;
+    return 0;
+}
+
+void
+_xcwm_event_ring_push(xcwm_context_t *context, xcwm_window_t *window,
+                      xcwm_event_type_t event_type)
+{
+    _xcwm_event_ring *ring = context->event_ring;
+    unsigned int head = ring->head;
+    unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    xcwm_event_record_t *record;
+
+    /* Full. Records already in the ring may not be replaced while the
+     * consumer could be reading them, so this one is lost */
+    if (head - tail > ring->mask) {
+        __atomic_fetch_add(&context->stats.ring_overruns, 1,
+                           __ATOMIC_RELAXED);
+        return;
+    }
+
+    record = &ring->records[head & ring->mask];
+    record->event_type = event_type;
+    if (window) {
+        record->window = xcwm_window_ref(window);
+        record->window_id = window->window_id;
+        xcwm_window_lock(window);
+        record->damage = window->dmg_region.extents;
+        record->bounds = window->bounds;
+        xcwm_window_unlock(window);
+    } else {
+        record->window = NULL;
+        record->window_id = XCB_NONE;
+        memset(&record->damage, 0, sizeof(xcwm_rect_t));
+        memset(&record->bounds, 0, sizeof(xcwm_rect_t));
+    }
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+int
+xcwm_event_ring_pop(xcwm_context_t *context, xcwm_event_record_t *record)
+{
+    _xcwm_event_ring *ring = context->event_ring;
+    unsigned int tail;
+
+    if (!ring) {
+        return 0;
+    }
+
+    tail = ring->tail;
+    if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    *record = ring->records[tail & ring->mask];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+unsigned long
+xcwm_event_ring_get_overruns(xcwm_context_t const *context)
+{
+    return __atomic_load_n(&context->stats.ring_overruns, __ATOMIC_RELAXED);
+}
+
+void
+_xcwm_event_ring_release(xcwm_context_t *context)
+{
+    _xcwm_event_ring *ring = context->event_ring;
+
+    if (ring) {
+        ring_free(ring);
+        context->event_ring = NULL;
+    }
+}
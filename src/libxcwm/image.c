@@ -31,32 +31,389 @@
 #include <xcb/xcb.h>
 #include <xcb/xcb_aux.h>
 #include <xcb/xcb_image.h>
+#ifdef HAVE_XCB_SHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <xcb/shm.h>
+#endif
 #include "xcwm_internal.h"
 
+/* The most bytes a pixel of a window can take */
+#define MAX_BYTES_PER_PIXEL 4
+
+/**
+ * Structure holding an image request waiting to be collected
+ */
+struct xcwm_image_request_t {
+    xcwm_window_t *window;
+    xcwm_rect_t area;
+    xcb_get_image_cookie_t cookie;
+#ifdef HAVE_XCB_SHM
+    int shm;                    /* 1 if read into the shm segment */
+    xcb_shm_get_image_cookie_t shm_cookie;
+#endif
+};
+
+#ifdef HAVE_XCB_SHM
+/*
+  A window's shared memory segment is used without the window locked,
+  as reading an image into it takes a round trip. Instead it is taken
+  for one image at a time with shm_acquire(), and nothing else may use,
+  grow or detach it until it is given back with shm_release(). If the
+  window stops being managed meanwhile, the segment is detached when it
+  is given back.
+ */
+
+/* Detach from the window's segment */
+static void
+shm_detach(xcwm_window_t *window)
+{
+    if (!window->shm_addr) {
+        return;
+    }
+
+    xcb_shm_detach(window->context->conn, window->shm_seg);
+    shmdt(window->shm_addr);
+
+    window->shm_seg = 0;
+    window->shm_addr = NULL;
+    window->shm_size = 0;
+}
+
+/* Take the window's segment for one image. Returns 0 if it is in use
+ * or the window is no longer managed. */
+static int
+shm_acquire(xcwm_window_t *window)
+{
+    int acquired = 0;
+
+    xcwm_window_lock(window);
+    if (!window->shm_busy && !window->shm_closed) {
+        window->shm_busy = 1;
+        acquired = 1;
+    }
+    xcwm_window_unlock(window);
+
+    return acquired;
+}
+
+/* Give back the segment taken by shm_acquire() */
+static void
+shm_release(xcwm_window_t *window)
+{
+    xcwm_window_lock(window);
+    window->shm_busy = 0;
+    if (window->shm_closed) {
+        shm_detach(window);
+    }
+    xcwm_window_unlock(window);
+}
+
+/* Make sure the window has a shared memory segment of at least size
+ * bytes. Returns 0 if it can't. The segment must have been taken. */
+static int
+shm_segment_reserve(xcwm_window_t *window, size_t size)
+{
+    xcb_connection_t *conn = window->context->conn;
+    xcb_generic_error_t *error;
+    xcb_shm_seg_t seg;
+    size_t window_size;
+    void *addr;
+    int shmid;
+
+    if (window->shm_size >= size) {
+        return 1;
+    }
+
+    /* Size the segment for the whole window, so it only needs to
+     * grow when the window does */
+    window_size = (size_t)window->bounds.width * window->bounds.height
+        * MAX_BYTES_PER_PIXEL;
+    if (size < window_size) {
+        size = window_size;
+    }
+
+    shm_detach(window);
+
+    shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+    if (shmid == -1) {
+        return 0;
+    }
+
+    addr = shmat(shmid, NULL, 0);
+    if (addr == (void *)-1) {
+        shmctl(shmid, IPC_RMID, NULL);
+        return 0;
+    }
+
+    seg = xcb_generate_id(conn);
+    error = xcb_request_check(conn,
+                              xcb_shm_attach_checked(conn, seg, shmid, 0));
+
+    /* Mark the segment for removal now, it stays until both we and
+     * the server detach from it */
+    shmctl(shmid, IPC_RMID, NULL);
+
+    if (error) {
+        /* Most likely the server isn't on this machine, so don't try
+         * again */
+        free(error);
+        shmdt(addr);
+        window->context->shm_present = 0;
+        return 0;
+    }
+
+    window->shm_seg = seg;
+    window->shm_addr = addr;
+    window->shm_size = size;
+
+    return 1;
+}
+
+/* Send a request to read an area of the window into its shared
+ * memory segment, which must have been taken. Returns 0 if the segment
+ * can't be used. */
+static int
+shm_request(xcwm_window_t *window, int x, int y, int width, int height,
+            xcb_shm_get_image_cookie_t *cookie)
+{
+    if (!shm_segment_reserve(window,
+                             (size_t)width * height * MAX_BYTES_PER_PIXEL)) {
+        return 0;
+    }
+
+    *cookie = xcb_shm_get_image(window->context->conn,
+                                window->composite_pixmap_id,
+                                x,
+                                y,
+                                width,
+                                height,
+                                (unsigned int)~0L,
+                                XCB_IMAGE_FORMAT_Z_PIXMAP,
+                                window->shm_seg,
+                                0);
+
+    return 1;
+}
+
+/* Read an area of the window into its shared memory segment. Returns
+ * the depth of the pixels read, with the segment taken until
+ * shm_release(), or 0 on failure. */
+static int
+shm_read(xcwm_window_t *window, int x, int y, int width, int height)
+{
+    xcb_shm_get_image_cookie_t cookie;
+    xcb_shm_get_image_reply_t *reply;
+    int depth;
+
+    if (!shm_acquire(window)) {
+        return 0;
+    }
+
+    if (!shm_request(window, x, y, width, height, &cookie)) {
+        shm_release(window);
+        return 0;
+    }
+
+    reply = xcb_shm_get_image_reply(window->context->conn, cookie, NULL);
+    if (!reply) {
+        shm_release(window);
+        return 0;
+    }
+
+    depth = reply->depth;
+    free(reply);
+
+    return depth;
+}
+
+/* Create an image from the pixels read into the window's shared
+ * memory segment, which must still be taken */
+static xcb_image_t *
+shm_image_create(xcwm_window_t *window, int width, int height, int depth)
+{
+    xcb_image_t *image;
+
+    /* Copy the image out of the segment, as the segment is reused for
+     * the next image of the window while this one may still be in
+     * use */
+    image = xcb_image_create_native(window->context->conn,
+                                    width,
+                                    height,
+                                    XCB_IMAGE_FORMAT_Z_PIXMAP,
+                                    depth,
+                                    NULL,
+                                    ~0,
+                                    NULL);
+    if (image && image->size <= window->shm_size) {
+        memcpy(image->data, window->shm_addr, image->size);
+    } else if (image) {
+        xcb_image_destroy(image);
+        image = NULL;
+    }
+
+    return image;
+}
+
+/* Get an image of an area of the window through its shared memory
+ * segment */
+static xcb_image_t *
+shm_image_get(xcwm_window_t *window, int x, int y, int width, int height)
+{
+    xcb_image_t *image;
+    int depth;
+
+    depth = shm_read(window, x, y, width, height);
+    if (!depth) {
+        return NULL;
+    }
+
+    image = shm_image_create(window, width, height, depth);
+    shm_release(window);
+
+    return image;
+}
+
+/* Find the bits per pixel and scanline pad of Z pixmaps of a depth */
+static int
+pixmap_format(xcb_connection_t *conn, int depth, int *bpp, int *pad)
+{
+    xcb_format_iterator_t iter =
+        xcb_setup_pixmap_formats_iterator(xcb_get_setup(conn));
+
+    for (; iter.rem; xcb_format_next(&iter)) {
+        if (iter.data->depth == depth) {
+            *bpp = iter.data->bits_per_pixel;
+            *pad = iter.data->scanline_pad;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+#endif
+
+/* Get an image of an area of the window, through shared memory when
+ * possible */
+static xcb_image_t *
+image_get(xcwm_window_t *window, int x, int y, int width, int height)
+{
+#ifdef HAVE_XCB_SHM
+    if (window->context->shm_present) {
+        xcb_image_t *image = shm_image_get(window, x, y, width, height);
+
+        if (image) {
+            return image;
+        }
+    }
+#endif
+
+    return xcb_image_get(window->context->conn,
+                         window->composite_pixmap_id,
+                         x,
+                         y,
+                         width,
+                         height,
+                         (unsigned int)~0L,
+                         XCB_IMAGE_FORMAT_Z_PIXMAP);
+}
+
+int
+_xcwm_image_read(xcwm_window_t *window, int x, int y, int width, int height,
+                 _xcwm_pixels *pixels)
+{
+    pixels->image = NULL;
+    pixels->shm_window = NULL;
+
+#ifdef HAVE_XCB_SHM
+    if (window->context->shm_present) {
+        int depth = shm_read(window, x, y, width, height);
+        int bpp;
+        int pad;
+
+        /* The segment is kept until the pixels are released */
+        if (depth
+            && pixmap_format(window->context->conn, depth, &bpp, &pad)) {
+            pixels->data = window->shm_addr;
+            pixels->stride = ((width * bpp + pad - 1) / pad) * pad / 8;
+            pixels->bpp = bpp;
+            pixels->depth = depth;
+            pixels->shm_window = window;
+            return 1;
+        }
+        if (depth) {
+            shm_release(window);
+        }
+    }
+#endif
+
+    pixels->image = xcb_image_get(window->context->conn,
+                                  window->composite_pixmap_id,
+                                  x,
+                                  y,
+                                  width,
+                                  height,
+                                  (unsigned int)~0L,
+                                  XCB_IMAGE_FORMAT_Z_PIXMAP);
+    if (!pixels->image) {
+        return 0;
+    }
+
+    pixels->data = pixels->image->data;
+    pixels->stride = pixels->image->stride;
+    pixels->bpp = pixels->image->bpp;
+    pixels->depth = pixels->image->depth;
+
+    return 1;
+}
+
+void
+_xcwm_pixels_release(_xcwm_pixels *pixels)
+{
+    if (pixels->image) {
+        xcb_image_destroy(pixels->image);
+        pixels->image = NULL;
+    }
+#ifdef HAVE_XCB_SHM
+    if (pixels->shm_window) {
+        shm_release(pixels->shm_window);
+        pixels->shm_window = NULL;
+    }
+#endif
+}
+
+void
+_xcwm_image_shm_release(xcwm_window_t *window)
+{
+#ifdef HAVE_XCB_SHM
+    /* If an image is being read through the segment, it is detached
+     * when that is done */
+    xcwm_window_lock(window);
+    window->shm_closed = 1;
+    if (!window->shm_busy) {
+        shm_detach(window);
+    }
+    xcwm_window_unlock(window);
+#endif
+}
 
 xcwm_image_t *
 xcwm_image_copy_full(xcwm_window_t *window)
 {
-
-    xcb_get_geometry_reply_t *geom_reply;
+    xcwm_rect_t bounds;
     xcb_image_t *image;
 
-    geom_reply = _xcwm_get_window_geometry(window->context->conn,
-                                           window->window_id);
+    xcwm_window_lock(window);
+    bounds = window->bounds;
+    xcwm_window_unlock(window);
 
-    if (!geom_reply)
+    if (bounds.width == 0 || bounds.height == 0) {
         return NULL;
+    }
 
-    xcb_flush(window->context->conn);
-    /* Get the full image of the window */
-    image = xcb_image_get(window->context->conn,
-                          window->composite_pixmap_id,
-                          0,
-                          0,
-                          geom_reply->width,
-                          geom_reply->height,
-                          (unsigned int)~0L,
-                          XCB_IMAGE_FORMAT_Z_PIXMAP);
+    /* Get the full image of the window, at the size last reported by
+     * the server */
+    image = image_get(window, 0, 0, bounds.width, bounds.height);
 
     if (!image) {
         return NULL;
@@ -65,50 +422,191 @@ xcwm_image_copy_full(xcwm_window_t *window)
     xcwm_image_t * xcwm_image = malloc(sizeof(xcwm_image_t));
 
     xcwm_image->image = image;
-    xcwm_image->x = geom_reply->x;
-    xcwm_image->y = geom_reply->y;
-    xcwm_image->width = geom_reply->width;
-    xcwm_image->height = geom_reply->height;
-
-    free(geom_reply);
+    xcwm_image->x = bounds.x;
+    xcwm_image->y = bounds.y;
+    xcwm_image->width = bounds.width;
+    xcwm_image->height = bounds.height;
 
     return xcwm_image;
 }
 
 xcwm_image_t *
 xcwm_image_copy_damaged(xcwm_window_t *window)
+{
+    xcwm_rect_t area;
+
+    /* Copy the bounding box of the damage, this covers every damaged
+     * rectangle. The window is only locked to read it, not while
+     * waiting for the image. */
+    xcwm_window_lock(window);
+    area = window->dmg_region.extents;
+    xcwm_window_unlock(window);
+
+    return xcwm_image_copy_area(window, &area);
+}
+
+xcwm_image_t *
+xcwm_image_copy_area(xcwm_window_t *window, xcwm_rect_t const *area)
 {
     xcb_image_t *image;
 
     xcb_flush(window->context->conn);
 
     /* Return null if image is 0 by 0 */
-    if (window->dmg_bounds.width == 0 || window->dmg_bounds.height == 0) {
+    if (area->width == 0 || area->height == 0) {
         return NULL;
     }
 
-    /* Get the image of the damaged area of the window */
-    image = xcb_image_get(window->context->conn,
-                          window->composite_pixmap_id,
-                          window->dmg_bounds.x,
-                          window->dmg_bounds.y,
-                          window->dmg_bounds.width,
-                          window->dmg_bounds.height,
-                          (unsigned int)~0L,
-                          XCB_IMAGE_FORMAT_Z_PIXMAP);
+    /* Get the image of the area of the window */
+    image = image_get(window, area->x, area->y, area->width, area->height);
 
     /* Failed to get a valid image, return null */
     if (!image) {
         return NULL;
     }
 
+    /* Note the area as copied, so xcwm_window_remove_damage() removes
+     * exactly this. If it can't be noted exactly, it's simply left
+     * damaged to be copied again. */
+    xcwm_window_lock(window);
+    _xcwm_region_append_rect(&window->dmg_captured, area);
+    xcwm_window_unlock(window);
+
     xcwm_image_t * xcwm_image = malloc(sizeof(xcwm_image_t));
 
     xcwm_image->image = image;
-    xcwm_image->x = window->dmg_bounds.x;
-    xcwm_image->y = window->dmg_bounds.y;
-    xcwm_image->width = window->dmg_bounds.width;
-    xcwm_image->height = window->dmg_bounds.height;
+    xcwm_image->x = area->x;
+    xcwm_image->y = area->y;
+    xcwm_image->width = area->width;
+    xcwm_image->height = area->height;
+
+    return xcwm_image;
+}
+
+xcwm_image_request_t *
+xcwm_image_request_damaged(xcwm_window_t *window)
+{
+    xcwm_rect_t area;
+
+    xcwm_window_lock(window);
+    area = window->dmg_region.extents;
+    xcwm_window_unlock(window);
+
+    return xcwm_image_request_area(window, &area);
+}
+
+xcwm_image_request_t *
+xcwm_image_request_area(xcwm_window_t *window, xcwm_rect_t const *area)
+{
+    xcwm_image_request_t *request;
+
+    if (area->width == 0 || area->height == 0) {
+        return NULL;
+    }
+
+    request = malloc(sizeof(xcwm_image_request_t));
+    if (!request) {
+        return NULL;
+    }
+
+    /* The window may be destroyed before the request is collected */
+    request->window = xcwm_window_ref(window);
+    request->area = *area;
+
+#ifdef HAVE_XCB_SHM
+    /* Nothing else may use the segment until this is collected */
+    request->shm = 0;
+    if (window->context->shm_present && shm_acquire(window)) {
+        if (shm_request(window, area->x, area->y, area->width, area->height,
+                        &request->shm_cookie)) {
+            request->shm = 1;
+            return request;
+        }
+        shm_release(window);
+    }
+#endif
+
+    request->cookie = xcb_get_image(window->context->conn,
+                                    XCB_IMAGE_FORMAT_Z_PIXMAP,
+                                    window->composite_pixmap_id,
+                                    area->x,
+                                    area->y,
+                                    area->width,
+                                    area->height,
+                                    (unsigned int)~0L);
+
+    return request;
+}
+
+xcwm_image_t *
+xcwm_image_collect(xcwm_image_request_t *request)
+{
+    xcwm_window_t *window;
+    xcb_get_image_reply_t *reply;
+    xcb_image_t *image = NULL;
+    xcwm_image_t *xcwm_image;
+
+    if (!request) {
+        return NULL;
+    }
+    window = request->window;
+
+#ifdef HAVE_XCB_SHM
+    if (request->shm) {
+        xcb_shm_get_image_reply_t *shm_reply =
+            xcb_shm_get_image_reply(window->context->conn,
+                                    request->shm_cookie, NULL);
+
+        if (shm_reply) {
+            image = shm_image_create(window,
+                                     request->area.width,
+                                     request->area.height,
+                                     shm_reply->depth);
+            free(shm_reply);
+        }
+        shm_release(window);
+    } else
+#endif
+    {
+        reply = xcb_get_image_reply(window->context->conn,
+                                    request->cookie, NULL);
+        if (reply) {
+            /* The image takes ownership of the reply, and uses its
+             * data directly */
+            image = xcb_image_create_native(window->context->conn,
+                                            request->area.width,
+                                            request->area.height,
+                                            XCB_IMAGE_FORMAT_Z_PIXMAP,
+                                            reply->depth,
+                                            reply,
+                                            xcb_get_image_data_length(reply),
+                                            xcb_get_image_data(reply));
+            if (!image) {
+                free(reply);
+            }
+        }
+    }
+
+    if (!image) {
+        xcwm_window_unref(window);
+        free(request);
+        return NULL;
+    }
+
+    /* Note the area as copied, as for xcwm_image_copy_area() */
+    xcwm_window_lock(window);
+    _xcwm_region_append_rect(&window->dmg_captured, &request->area);
+    xcwm_window_unlock(window);
+    xcwm_window_unref(window);
+
+    xcwm_image = malloc(sizeof(xcwm_image_t));
+    xcwm_image->image = image;
+    xcwm_image->x = request->area.x;
+    xcwm_image->y = request->area.y;
+    xcwm_image->width = request->area.width;
+    xcwm_image->height = request->area.height;
+
+    free(request);
 
     return xcwm_image;
 }
@@ -32,6 +32,9 @@
 #include <xcb/composite.h>
 #include <xcb/xtest.h>
 #include <xcb/xfixes.h>
+#ifdef HAVE_XCB_SHM
+#include <xcb/shm.h>
+#endif
 #include <xcwm/xcwm.h>
 #include "xcwm_internal.h"
 
@@ -151,3 +154,31 @@ _xcwm_init_shape(xcwm_context_t *contxt)
     free(reply);
 }
 
+void
+_xcwm_init_shm(xcwm_context_t *contxt)
+{
+    contxt->shm_present = 0;
+
+#ifdef HAVE_XCB_SHM
+    const xcb_query_extension_reply_t *reply =
+        xcb_get_extension_data(contxt->conn, &xcb_shm_id);
+
+    if (!reply || !reply->present) {
+        printf("MIT-SHM extension not present\n");
+        return;
+    }
+
+    xcb_shm_query_version_cookie_t cookie =
+        xcb_shm_query_version(contxt->conn);
+
+    xcb_shm_query_version_reply_t *version_reply =
+        xcb_shm_query_version_reply(contxt->conn, cookie, NULL);
+
+    if (version_reply) {
+        printf("MIT-SHM extension present\n");
+        contxt->shm_present = 1;
+    }
+
+    free(version_reply);
+#endif
+}
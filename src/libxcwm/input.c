@@ -44,7 +44,7 @@ xcwm_input_key_event(xcwm_context_t *context, uint8_t code, int state)
     xcb_test_fake_input(context->conn, key_state, code,
                         XCB_CURRENT_TIME, none, 0, 0, 1);
 
-    xcb_flush(context->conn);
+    _xcwm_flush(context);
     /* printf("Injected key event - key code %i\n", code); */
 }
 
@@ -64,7 +64,7 @@ xcwm_input_mouse_button_event(xcwm_context_t *context,
     xcb_test_fake_input(context->conn, button_state, button,
                         XCB_CURRENT_TIME,
                         XCB_NONE, 0, 0, 0);
-    xcb_flush(context->conn);
+    _xcwm_flush(context);
     /* printf("Injected mouse event - button %d, state: %d\n", */
     /*        button, state); */
 }
@@ -74,5 +74,5 @@ xcwm_input_mouse_motion(xcwm_context_t *context, long x, long y)
 {
     xcb_test_fake_input(context->conn, XCB_MOTION_NOTIFY, 0, XCB_CURRENT_TIME,
                         context->root_window->window_id, x, y, 0);
-    xcb_flush(context->conn);
+    _xcwm_flush(context);
 }
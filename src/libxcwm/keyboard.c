@@ -56,7 +56,7 @@ xcwm_keyboard_set_mapping (xcwm_context_t *context,
         fprintf(stderr, "\nError code: %d\n", error->error_code);
     }
 
-    xcb_flush(context->conn);
+    _xcwm_flush(context);
 }
 
 void
@@ -80,5 +80,5 @@ xcwm_keyboard_set_modifier_map (xcwm_context_t *context,
         fprintf(stderr, "\nError code: %d\n", error->error_code);
     }
     free(map_reply);
-    xcb_flush(context->conn);
+    _xcwm_flush(context);
 }
@@ -0,0 +1,346 @@
+/* Copyright (c) 2013 The libxcwm authors
+ *
+ * reactor.c
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <xcwm/xcwm.h>
+#include "xcwm_internal.h"
+
+/*
+  The shared event loop ("reactor"): a single thread which waits on the
+  file descriptors of the connections of all of its contexts with
+  poll(), and drains each connection that becomes readable without
+  blocking.
+
+  The lock is not held while a connection is drained, so the client's
+  callbacks may start and close other contexts. The thread holds a
+  reference to each entry it is servicing, so an entry removed meanwhile
+  stays valid until the thread is done with it.
+ */
+
+/* A context serviced by the shared loop */
+typedef struct _reactor_entry {
+    xcwm_context_t *context;
+    int prepared;       /* 1 once existing windows have been adopted */
+    int removed;        /* 1 once removed from the entries */
+    int refs;           /* References held, by the entries and the thread */
+} _reactor_entry;
+
+typedef struct _reactor {
+    pthread_mutex_t lock;       /* Protects everything below */
+    pthread_cond_t idle;        /* Signalled when busy is cleared */
+    pthread_t thread;
+    int running;                /* 1 while the thread is running */
+    int wakeup_pipe[2];         /* Used to interrupt poll() */
+    _reactor_entry **entries;
+    int num_entries;
+    int max_entries;
+    _reactor_entry *busy;       /* Entry being drained without the lock */
+} _reactor;
+
+static _reactor reactor = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, { -1, -1 },
+    NULL, 0, 0, NULL
+};
+
+/* Functions only used within this file */
+
+/* The body of the shared event loop thread */
+static void *
+run_reactor(void *arg);
+
+/* Wake the thread from poll() so it notices changed entries */
+static void
+reactor_wakeup(void);
+
+/* Remove the entry at the given index. Lock must be held. */
+static void
+reactor_remove_entry(int index);
+
+/* Drop a reference to an entry. Lock must be held. */
+static void
+reactor_entry_unref(_reactor_entry *entry);
+
+/* Process the events of an entry's context. Lock must be held, it is
+ * released while the connection is drained. */
+static void
+reactor_service(_reactor_entry *entry, int queued_only);
+
+int
+_xcwm_reactor_add(xcwm_context_t *context)
+{
+    _reactor_entry *entry;
+    int ret_val = 0;
+
+    entry = malloc(sizeof(_reactor_entry));
+    if (!entry) {
+        return ENOMEM;
+    }
+    entry->context = context;
+    entry->prepared = 0;
+    entry->removed = 0;
+    entry->refs = 1;
+
+    pthread_mutex_lock(&reactor.lock);
+
+    if (reactor.wakeup_pipe[0] < 0) {
+        if (pipe(reactor.wakeup_pipe) != 0) {
+            ret_val = errno;
+            pthread_mutex_unlock(&reactor.lock);
+            free(entry);
+            return ret_val;
+        }
+        fcntl(reactor.wakeup_pipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(reactor.wakeup_pipe[1], F_SETFL, O_NONBLOCK);
+    }
+
+    if (reactor.num_entries == reactor.max_entries) {
+        if (reactor.max_entries) {
+            reactor.max_entries *= 2;
+        } else {
+            reactor.max_entries = 8;
+        }
+        reactor.entries =
+            realloc(reactor.entries,
+                    reactor.max_entries * sizeof(_reactor_entry *));
+        assert(reactor.entries);
+    }
+    reactor.entries[reactor.num_entries++] = entry;
+    context->event_shared = 1;
+
+    if (!reactor.running) {
+        ret_val = pthread_create(&reactor.thread, NULL, run_reactor, NULL);
+        if (ret_val == 0) {
+            pthread_detach(reactor.thread);
+            reactor.running = 1;
+        } else {
+            reactor_remove_entry(reactor.num_entries - 1);
+        }
+    } else {
+        reactor_wakeup();
+    }
+
+    pthread_mutex_unlock(&reactor.lock);
+
+    return ret_val;
+}
+
+int
+_xcwm_reactor_remove(xcwm_context_t *context)
+{
+    _reactor_entry *entry = NULL;
+    int i;
+
+    pthread_mutex_lock(&reactor.lock);
+    for (i = 0; i < reactor.num_entries; i++) {
+        if (reactor.entries[i]->context == context) {
+            entry = reactor.entries[i];
+            entry->refs++;
+            reactor_remove_entry(i);
+            reactor_wakeup();
+            break;
+        }
+    }
+
+    /* Once this returns the context may be freed, so wait for the
+     * thread to finish draining it. A context closed from its own
+     * callback can't be waited for. */
+    if (entry) {
+        while (reactor.busy == entry
+               && !pthread_equal(pthread_self(), reactor.thread)) {
+            pthread_cond_wait(&reactor.idle, &reactor.lock);
+        }
+        reactor_entry_unref(entry);
+    }
+    pthread_mutex_unlock(&reactor.lock);
+
+    return 0;
+}
+
+static void
+reactor_remove_entry(int index)
+{
+    _reactor_entry *entry = reactor.entries[index];
+
+    entry->context->event_shared = 0;
+    entry->removed = 1;
+    reactor.num_entries--;
+    reactor.entries[index] = reactor.entries[reactor.num_entries];
+    reactor_entry_unref(entry);
+}
+
+static void
+reactor_entry_unref(_reactor_entry *entry)
+{
+    if (--entry->refs == 0) {
+        free(entry);
+    }
+}
+
+static void
+reactor_service(_reactor_entry *entry, int queued_only)
+{
+    xcwm_context_t *context = entry->context;
+    int count;
+    int i;
+
+    if (entry->removed) {
+        return;
+    }
+
+    reactor.busy = entry;
+    pthread_mutex_unlock(&reactor.lock);
+
+    if (!entry->prepared) {
+        _xcwm_event_loop_prepare(context);
+        entry->prepared = 1;
+    }
+    count = _xcwm_event_drain(context, 0, queued_only);
+    if (count >= 0) {
+        xcb_flush(context->conn);
+    }
+
+    pthread_mutex_lock(&reactor.lock);
+    reactor.busy = NULL;
+    pthread_cond_broadcast(&reactor.idle);
+
+    if (count < 0 && !entry->removed) {
+        fprintf(stderr, "Connection error in shared event loop\n");
+        for (i = 0; i < reactor.num_entries; i++) {
+            if (reactor.entries[i] == entry) {
+                reactor_remove_entry(i);
+                break;
+            }
+        }
+    }
+}
+
+static void
+reactor_wakeup(void)
+{
+    char c = 0;
+
+    /* If the pipe is full, the thread is going to wake anyway */
+    if (write(reactor.wakeup_pipe[1], &c, 1) < 0) {
+        return;
+    }
+}
+
+static void *
+run_reactor(void *arg)
+{
+    _reactor_entry **serviced = NULL;
+    struct pollfd *fds = NULL;
+    int max_serviced = 0;
+    int num_serviced;
+    int timeout;
+    int i;
+
+    pthread_mutex_lock(&reactor.lock);
+
+    while (reactor.num_entries > 0) {
+        /* Take a reference to each entry serviced in this pass, as
+         * entries may be added and removed whenever the lock is
+         * released */
+        num_serviced = reactor.num_entries;
+        if (num_serviced > max_serviced) {
+            max_serviced = num_serviced;
+            serviced = realloc(serviced,
+                               max_serviced * sizeof(_reactor_entry *));
+            fds = realloc(fds, (max_serviced + 1) * sizeof(struct pollfd));
+            assert(serviced && fds);
+        }
+        for (i = 0; i < num_serviced; i++) {
+            serviced[i] = reactor.entries[i];
+            serviced[i]->refs++;
+        }
+
+        /* Adopt the windows of newly added contexts, and process any
+         * events which have already been read from the connection, as
+         * poll() will not report those */
+        for (i = 0; i < num_serviced; i++) {
+            reactor_service(serviced[i], 1);
+        }
+
+        /* Wait for the wakeup pipe and all of the connections */
+        fds[0].fd = reactor.wakeup_pipe[0];
+        fds[0].events = POLLIN;
+        timeout = -1;
+        for (i = 0; i < num_serviced; i++) {
+            int context_timeout;
+
+            fds[i + 1].events = POLLIN;
+            fds[i + 1].revents = 0;
+
+            /* poll() ignores negative descriptors */
+            if (serviced[i]->removed) {
+                fds[i + 1].fd = -1;
+                continue;
+            }
+            fds[i + 1].fd =
+                xcb_get_file_descriptor(serviced[i]->context->conn);
+
+            /* Wake in time for the earliest frame due */
+            context_timeout = _xcwm_event_timeout(serviced[i]->context);
+            if (context_timeout >= 0
+                && (timeout < 0 || context_timeout < timeout)) {
+                timeout = context_timeout;
+            }
+        }
+
+        pthread_mutex_unlock(&reactor.lock);
+        if (poll(fds, num_serviced + 1, timeout) < 0 && errno != EINTR) {
+            perror("poll");
+        }
+        pthread_mutex_lock(&reactor.lock);
+
+        if (fds[0].revents & POLLIN) {
+            char buf[64];
+            while (read(reactor.wakeup_pipe[0], buf, sizeof(buf)) > 0);
+        }
+
+        /* Entries removed while waiting are skipped */
+        for (i = 0; i < num_serviced; i++) {
+            if (fds[i + 1].revents) {
+                reactor_service(serviced[i], 0);
+            }
+            reactor_entry_unref(serviced[i]);
+        }
+    }
+
+    reactor.running = 0;
+    pthread_mutex_unlock(&reactor.lock);
+
+    free(serviced);
+    free(fds);
+    return NULL;
+}
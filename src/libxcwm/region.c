@@ -0,0 +1,355 @@
+/* Copyright (c) 2013 The libxcwm authors
+ *
+ * region.c
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <xcwm/xcwm.h>
+#include "xcwm_internal.h"
+
+/*
+  A small client-side region: a bounded list of rectangles. Union may
+  over-approximate the exact area by merging rectangles when the list
+  is full, which is harmless for damage, but never loses area.
+ */
+
+/* Functions only used within this file */
+
+/* Area of the rectangle */
+static long
+rect_area(xcwm_rect_t const *rect);
+
+/* Set result to the bounding box of a and b */
+static void
+rect_bounds(xcwm_rect_t const *a, xcwm_rect_t const *b,
+            xcwm_rect_t *result);
+
+/* 1 if outer fully contains inner */
+static int
+rect_contains(xcwm_rect_t const *outer, xcwm_rect_t const *inner);
+
+/* 1 if the rectangles overlap */
+static int
+rect_intersects(xcwm_rect_t const *a, xcwm_rect_t const *b);
+
+/* Area of the overlap of the rectangles */
+static long
+rect_intersection_area(xcwm_rect_t const *a, xcwm_rect_t const *b);
+
+/* Merge rectangles until at most max remain */
+static int
+rects_reduce(xcwm_rect_t *rects, int num_rects, int max);
+
+/* Recompute the extents of the region */
+static void
+region_update_extents(_xcwm_region *region);
+
+static long
+rect_area(xcwm_rect_t const *rect)
+{
+    return (long)rect->width * rect->height;
+}
+
+static void
+rect_bounds(xcwm_rect_t const *a, xcwm_rect_t const *b, xcwm_rect_t *result)
+{
+    int x1 = a->x < b->x ? a->x : b->x;
+    int y1 = a->y < b->y ? a->y : b->y;
+    int x2 = a->x + a->width > b->x + b->width ?
+        a->x + a->width : b->x + b->width;
+    int y2 = a->y + a->height > b->y + b->height ?
+        a->y + a->height : b->y + b->height;
+
+    result->x = x1;
+    result->y = y1;
+    result->width = x2 - x1;
+    result->height = y2 - y1;
+}
+
+static int
+rect_contains(xcwm_rect_t const *outer, xcwm_rect_t const *inner)
+{
+    return (inner->x >= outer->x
+            && inner->y >= outer->y
+            && inner->x + inner->width <= outer->x + outer->width
+            && inner->y + inner->height <= outer->y + outer->height);
+}
+
+static int
+rect_intersects(xcwm_rect_t const *a, xcwm_rect_t const *b)
+{
+    return (a->x < b->x + b->width
+            && b->x < a->x + a->width
+            && a->y < b->y + b->height
+            && b->y < a->y + a->height);
+}
+
+static long
+rect_intersection_area(xcwm_rect_t const *a, xcwm_rect_t const *b)
+{
+    int x1 = a->x > b->x ? a->x : b->x;
+    int y1 = a->y > b->y ? a->y : b->y;
+    int x2 = a->x + a->width < b->x + b->width ?
+        a->x + a->width : b->x + b->width;
+    int y2 = a->y + a->height < b->y + b->height ?
+        a->y + a->height : b->y + b->height;
+
+    if (x2 <= x1 || y2 <= y1) {
+        return 0;
+    }
+    return (long)(x2 - x1) * (y2 - y1);
+}
+
+static int
+rects_reduce(xcwm_rect_t *rects, int num_rects, int max)
+{
+    while (num_rects > max) {
+        long best_waste = -1;
+        int best_i = 0;
+        int best_j = 1;
+        int i;
+        int j;
+
+        /* Find the pair whose bounding box adds the least area not
+         * already covered by the pair */
+        for (i = 0; i < num_rects; i++) {
+            for (j = i + 1; j < num_rects; j++) {
+                xcwm_rect_t merged;
+                long waste;
+
+                rect_bounds(&rects[i], &rects[j], &merged);
+                waste = rect_area(&merged)
+                    - rect_area(&rects[i]) - rect_area(&rects[j]);
+                if (best_waste < 0 || waste < best_waste) {
+                    best_waste = waste;
+                    best_i = i;
+                    best_j = j;
+                }
+            }
+        }
+
+        rect_bounds(&rects[best_i], &rects[best_j], &rects[best_i]);
+        rects[best_j] = rects[--num_rects];
+    }
+    return num_rects;
+}
+
+static void
+region_update_extents(_xcwm_region *region)
+{
+    int i;
+
+    if (!region->num_rects) {
+        region->extents.x = 0;
+        region->extents.y = 0;
+        region->extents.width = 0;
+        region->extents.height = 0;
+        return;
+    }
+
+    region->extents = region->rects[0];
+    for (i = 1; i < region->num_rects; i++) {
+        rect_bounds(&region->extents, &region->rects[i], &region->extents);
+    }
+}
+
+int
+_xcwm_rect_clip(xcwm_rect_t *rect, int width, int height)
+{
+    int x2 = rect->x + rect->width;
+    int y2 = rect->y + rect->height;
+
+    if (rect->x < 0)
+        rect->x = 0;
+    if (rect->y < 0)
+        rect->y = 0;
+    if (x2 > width)
+        x2 = width;
+    if (y2 > height)
+        y2 = height;
+
+    if (x2 <= rect->x || y2 <= rect->y) {
+        rect->width = 0;
+        rect->height = 0;
+        return 0;
+    }
+
+    rect->width = x2 - rect->x;
+    rect->height = y2 - rect->y;
+    return 1;
+}
+
+void
+_xcwm_region_init(_xcwm_region *region)
+{
+    region->num_rects = 0;
+    region_update_extents(region);
+}
+
+void
+_xcwm_region_union_rect(_xcwm_region *region, xcwm_rect_t const *rect)
+{
+    xcwm_rect_t add = *rect;
+    int i;
+
+    if (add.width <= 0 || add.height <= 0) {
+        return;
+    }
+
+    /* Absorb rectangles covered by the new one, and any whose
+     * bounding box with it covers no extra area */
+    i = 0;
+    while (i < region->num_rects) {
+        xcwm_rect_t *cur = &region->rects[i];
+        xcwm_rect_t merged;
+
+        if (rect_contains(cur, &add)) {
+            return;
+        }
+        rect_bounds(cur, &add, &merged);
+        if (rect_area(&merged) == rect_area(cur) + rect_area(&add)
+            - rect_intersection_area(cur, &add)) {
+            add = merged;
+            region->rects[i] = region->rects[--region->num_rects];
+            /* The grown rectangle may now merge with earlier ones */
+            i = 0;
+            continue;
+        }
+        i++;
+    }
+
+    if (region->num_rects < _XCWM_REGION_MAX_RECTS) {
+        region->rects[region->num_rects++] = add;
+    } else {
+        xcwm_rect_t rects[_XCWM_REGION_MAX_RECTS + 1];
+
+        memcpy(rects, region->rects, sizeof(region->rects));
+        rects[_XCWM_REGION_MAX_RECTS] = add;
+        region->num_rects = rects_reduce(rects, _XCWM_REGION_MAX_RECTS + 1,
+                                         _XCWM_REGION_MAX_RECTS);
+        memcpy(region->rects, rects, sizeof(region->rects));
+    }
+    region_update_extents(region);
+}
+
+int
+_xcwm_region_append_rect(_xcwm_region *region, xcwm_rect_t const *rect)
+{
+    int i;
+
+    if (rect->width <= 0 || rect->height <= 0) {
+        return 1;
+    }
+    for (i = 0; i < region->num_rects; i++) {
+        if (rect_contains(&region->rects[i], rect)) {
+            return 1;
+        }
+    }
+    if (region->num_rects == _XCWM_REGION_MAX_RECTS) {
+        return 0;
+    }
+    region->rects[region->num_rects++] = *rect;
+    region_update_extents(region);
+    return 1;
+}
+
+void
+_xcwm_region_subtract_rect(_xcwm_region *region, xcwm_rect_t const *rect)
+{
+    /* Each rectangle splits into at most four pieces */
+    xcwm_rect_t pieces[_XCWM_REGION_MAX_RECTS * 4];
+    int num_pieces = 0;
+    int i;
+
+    if (rect->width <= 0 || rect->height <= 0) {
+        return;
+    }
+
+    for (i = 0; i < region->num_rects; i++) {
+        xcwm_rect_t const *cur = &region->rects[i];
+        int top;
+        int bottom;
+
+        if (!rect_intersects(cur, rect)) {
+            pieces[num_pieces++] = *cur;
+            continue;
+        }
+
+        /* Band above the subtracted rectangle */
+        top = cur->y;
+        if (rect->y > cur->y) {
+            pieces[num_pieces].x = cur->x;
+            pieces[num_pieces].y = cur->y;
+            pieces[num_pieces].width = cur->width;
+            pieces[num_pieces].height = rect->y - cur->y;
+            num_pieces++;
+            top = rect->y;
+        }
+
+        /* Band below */
+        bottom = cur->y + cur->height;
+        if (rect->y + rect->height < bottom) {
+            pieces[num_pieces].x = cur->x;
+            pieces[num_pieces].y = rect->y + rect->height;
+            pieces[num_pieces].width = cur->width;
+            pieces[num_pieces].height = bottom - (rect->y + rect->height);
+            num_pieces++;
+            bottom = rect->y + rect->height;
+        }
+
+        /* Left and right of it, between the bands */
+        if (rect->x > cur->x) {
+            pieces[num_pieces].x = cur->x;
+            pieces[num_pieces].y = top;
+            pieces[num_pieces].width = rect->x - cur->x;
+            pieces[num_pieces].height = bottom - top;
+            num_pieces++;
+        }
+        if (rect->x + rect->width < cur->x + cur->width) {
+            pieces[num_pieces].x = rect->x + rect->width;
+            pieces[num_pieces].y = top;
+            pieces[num_pieces].width =
+                cur->x + cur->width - (rect->x + rect->width);
+            pieces[num_pieces].height = bottom - top;
+            num_pieces++;
+        }
+    }
+
+    region->num_rects = rects_reduce(pieces, num_pieces,
+                                     _XCWM_REGION_MAX_RECTS);
+    memcpy(region->rects, pieces, region->num_rects * sizeof(xcwm_rect_t));
+    region_update_extents(region);
+}
+
+void
+_xcwm_region_subtract(_xcwm_region *region, _xcwm_region const *other)
+{
+    int i;
+
+    for (i = 0; i < other->num_rects; i++) {
+        _xcwm_region_subtract_rect(region, &other->rects[i]);
+    }
+}
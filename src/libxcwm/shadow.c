@@ -0,0 +1,291 @@
+/* Copyright (c) 2013 The libxcwm authors
+ *
+ * shadow.c
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <xcwm/xcwm.h>
+#include "xcwm_internal.h"
+
+/* Note a rectangle as changed in the current generation */
+static void
+history_add(_xcwm_shadow *shadow, xcwm_rect_t const *rect)
+{
+    int i = shadow->history_next;
+
+    /* Anything older than the entry being replaced can no longer be
+     * reported exactly */
+    if (shadow->history[i].generation > shadow->history_floor) {
+        shadow->history_floor = shadow->history[i].generation;
+    }
+
+    shadow->history[i].generation = shadow->pub.generation;
+    shadow->history[i].rect = *rect;
+    shadow->history_next = (i + 1) % _XCWM_SHADOW_HISTORY;
+}
+
+/* Copy pixels read from the window into the shadow buffer at x, y */
+static void
+shadow_blit(_xcwm_shadow *shadow, _xcwm_pixels const *pixels,
+            xcwm_rect_t const *rect)
+{
+    int bytes_pp = shadow->pub.bpp / 8;
+    uint8_t *dst = shadow->pub.data + rect->y * shadow->pub.stride
+        + rect->x * bytes_pp;
+    uint8_t *src = pixels->data;
+    int row;
+
+    for (row = 0; row < rect->height; row++) {
+        memcpy(dst, src, rect->width * bytes_pp);
+        dst += shadow->pub.stride;
+        src += pixels->stride;
+    }
+}
+
+/* Read the whole window into a shadow buffer of the given size */
+static int
+shadow_read_full(xcwm_window_t *window, xcwm_rect_t const *bounds)
+{
+    _xcwm_shadow *shadow = window->shadow;
+    xcwm_rect_t area = { 0, 0, bounds->width, bounds->height };
+    _xcwm_pixels pixels;
+    uint8_t *data;
+    int stride;
+
+    if (area.width <= 0 || area.height <= 0) {
+        return 0;
+    }
+
+    if (!_xcwm_image_read(window, 0, 0, area.width, area.height, &pixels)) {
+        return 0;
+    }
+
+    if (pixels.bpp % 8) {
+        _xcwm_pixels_release(&pixels);
+        return 0;
+    }
+
+    /* Keep rows 4 byte aligned */
+    stride = ((area.width * pixels.bpp / 8) + 3) & ~3;
+    if (shadow->pub.data && stride * area.height
+        <= shadow->pub.stride * shadow->pub.height) {
+        data = shadow->pub.data;
+    } else {
+        data = realloc(shadow->pub.data, (size_t)stride * area.height);
+        if (!data) {
+            _xcwm_pixels_release(&pixels);
+            return 0;
+        }
+    }
+
+    shadow->pub.data = data;
+    shadow->pub.width = area.width;
+    shadow->pub.height = area.height;
+    shadow->pub.stride = stride;
+    shadow->pub.bpp = pixels.bpp;
+    shadow->pub.depth = pixels.depth;
+
+    shadow_blit(shadow, &pixels, &area);
+    _xcwm_pixels_release(&pixels);
+
+    /* Anyone who saw an earlier generation needs the whole buffer */
+    shadow->pub.generation++;
+    shadow->history_floor = shadow->pub.generation - 1;
+    history_add(shadow, &area);
+
+    /* Everything damaged so far has now been read */
+    xcwm_window_lock(window);
+    _xcwm_region_init(&window->dmg_captured);
+    _xcwm_region_append_rect(&window->dmg_captured, &area);
+    xcwm_window_unlock(window);
+
+    return 1;
+}
+
+void
+xcwm_shadow_enable(xcwm_window_t *window)
+{
+    if (window->shadow) {
+        return;
+    }
+
+    window->shadow = calloc(1, sizeof(_xcwm_shadow));
+    if (window->shadow) {
+        _xcwm_region_init(&window->shadow->dirty);
+        pthread_mutex_init(&window->shadow->lock, NULL);
+    }
+}
+
+void
+xcwm_shadow_disable(xcwm_window_t *window)
+{
+    if (!window->shadow) {
+        return;
+    }
+
+    /* Let an update in progress finish */
+    pthread_mutex_lock(&window->shadow->lock);
+    pthread_mutex_unlock(&window->shadow->lock);
+
+    pthread_mutex_destroy(&window->shadow->lock);
+    free(window->shadow->pub.data);
+    free(window->shadow);
+    window->shadow = NULL;
+}
+
+/* Update the window's shadow buffer, with the shadow locked */
+static unsigned long
+shadow_update(xcwm_window_t *window)
+{
+    _xcwm_shadow *shadow = window->shadow;
+    xcwm_rect_t rects[_XCWM_REGION_MAX_RECTS];
+    xcwm_rect_t bounds;
+    int num_rects;
+    int captured = 0;
+    int i;
+
+    /* Take note of what to read with the window locked, but read it
+     * without, as each read waits for the server */
+    xcwm_window_lock(window);
+    bounds = window->bounds;
+    num_rects = window->dmg_region.num_rects;
+    memcpy(rects, window->dmg_region.rects, num_rects * sizeof(xcwm_rect_t));
+    xcwm_window_unlock(window);
+
+    /* Read everything if the window has changed size */
+    if (!shadow->pub.data
+        || shadow->pub.width != bounds.width
+        || shadow->pub.height != bounds.height) {
+        if (shadow_read_full(window, &bounds)) {
+            xcwm_window_remove_damage(window);
+        }
+        return shadow->pub.generation;
+    }
+
+    if (!num_rects) {
+        return shadow->pub.generation;
+    }
+
+    shadow->pub.generation++;
+    for (i = 0; i < num_rects; i++) {
+        xcwm_rect_t area = rects[i];
+        _xcwm_pixels pixels;
+
+        /* Damage from before the window shrank can lie outside the
+         * buffer. That part no longer exists, so is simply removed. */
+        if (_xcwm_rect_clip(&area, shadow->pub.width, shadow->pub.height)) {
+            if (!_xcwm_image_read(window, area.x, area.y,
+                                  area.width, area.height, &pixels)) {
+                continue;
+            }
+
+            /* The format can only change with the window's visual,
+             * which is fixed, but check rather than overrun the
+             * buffer */
+            if (pixels.bpp != shadow->pub.bpp) {
+                _xcwm_pixels_release(&pixels);
+                continue;
+            }
+            shadow_blit(shadow, &pixels, &area);
+            history_add(shadow, &area);
+            _xcwm_pixels_release(&pixels);
+        }
+
+        xcwm_window_lock(window);
+        _xcwm_region_append_rect(&window->dmg_captured, &rects[i]);
+        xcwm_window_unlock(window);
+        captured = 1;
+    }
+
+    /* Only what was read is removed, damage reported since stays */
+    if (captured) {
+        xcwm_window_remove_damage(window);
+    }
+
+    return shadow->pub.generation;
+}
+
+unsigned long
+xcwm_shadow_update(xcwm_window_t *window)
+{
+    _xcwm_shadow *shadow = window->shadow;
+    unsigned long generation;
+
+    if (!shadow) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&shadow->lock);
+    generation = shadow_update(window);
+    pthread_mutex_unlock(&shadow->lock);
+
+    return generation;
+}
+
+xcwm_shadow_t const *
+xcwm_shadow_get(xcwm_window_t const *window)
+{
+    if (!window->shadow) {
+        return NULL;
+    }
+
+    return &window->shadow->pub;
+}
+
+xcwm_rect_t const *
+xcwm_shadow_get_dirty_rects(xcwm_window_t *window,
+                            unsigned long generation, int *count)
+{
+    _xcwm_shadow *shadow = window->shadow;
+    int i;
+
+    *count = 0;
+    if (!shadow) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&shadow->lock);
+    _xcwm_region_init(&shadow->dirty);
+
+    if (generation < shadow->history_floor) {
+        xcwm_rect_t all = { 0, 0, shadow->pub.width, shadow->pub.height };
+
+        _xcwm_region_union_rect(&shadow->dirty, &all);
+    } else {
+        for (i = 0; i < _XCWM_SHADOW_HISTORY; i++) {
+            if (shadow->history[i].generation > generation) {
+                _xcwm_region_union_rect(&shadow->dirty,
+                                        &shadow->history[i].rect);
+            }
+        }
+    }
+
+    *count = shadow->dirty.num_rects;
+    pthread_mutex_unlock(&shadow->lock);
+
+    return shadow->dirty.rects;
+}
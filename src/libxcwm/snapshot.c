@@ -0,0 +1,354 @@
+/* Copyright (c) 2013 The libxcwm authors
+ *
+ * snapshot.c
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <assert.h>
+#include <xcwm/xcwm.h>
+#include "xcwm_internal.h"
+
+/*
+  Snapshots are made at the end of each drain of events, or when one is
+  asked for and something has changed since the last, and replace the
+  context's current snapshot. The snapshot_lock is held while making
+  one, while changing the stacking order, and while taking a reference
+  to the current snapshot, never while a snapshot is read.
+
+  Each window keeps its state as it is to appear in snapshots, updated
+  with the window locked whenever that changes. So that a snapshot can
+  be made without locking any window, the state is guarded by a
+  sequence count, which is odd while it is being updated: it is copied
+  again if the count changed while copying it.
+ */
+
+/* Copy the state of a window for a snapshot */
+static void
+window_state_read(xcwm_window_t *window, xcwm_snapshot_window_t *state)
+{
+    unsigned int seq;
+
+    for (;;) {
+        seq = __atomic_load_n(&window->snapshot_seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        *state = window->snapshot_state;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (seq == __atomic_load_n(&window->snapshot_seq,
+                                   __ATOMIC_RELAXED)) {
+            return;
+        }
+    }
+}
+
+void
+_xcwm_snapshot_window_changed(xcwm_window_t *window, int appearance)
+{
+    xcwm_snapshot_window_t *state = &window->snapshot_state;
+
+    xcwm_window_lock(window);
+    __atomic_store_n(&window->snapshot_seq, window->snapshot_seq + 1,
+                     __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    if (appearance) {
+        state->window_id = window->window_id;
+        state->type = window->type;
+        state->override_redirect = window->override_redirect;
+        state->opacity = window->opacity;
+    }
+    state->bounds = window->bounds;
+    state->damage = window->dmg_region.extents;
+
+    __atomic_store_n(&window->snapshot_seq, window->snapshot_seq + 1,
+                     __ATOMIC_RELEASE);
+    xcwm_window_unlock(window);
+
+    _xcwm_snapshot_changed(window->context);
+}
+
+static _xcwm_snapshot *
+snapshot_from_pub(xcwm_snapshot_t const *snapshot)
+{
+    return (_xcwm_snapshot *)((char *)snapshot
+                              - offsetof(_xcwm_snapshot, pub));
+}
+
+static void
+snapshot_unref(_xcwm_snapshot *snapshot)
+{
+    if (__atomic_sub_fetch(&snapshot->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(snapshot);
+    }
+}
+
+/* Make a new snapshot if anything has changed, with the snapshot_lock
+ * held. Returns the snapshot replaced, for the caller to drop. */
+static _xcwm_snapshot *
+snapshot_make(xcwm_context_t *context)
+{
+    _xcwm_snapshot *snapshot;
+    _xcwm_snapshot *old;
+    xcwm_snapshot_window_t *states;
+    int i;
+
+    if (!__atomic_exchange_n(&context->snapshot_dirty, 0,
+                             __ATOMIC_ACQ_REL)) {
+        return NULL;
+    }
+
+    /* The states follow the snapshot in the same allocation */
+    snapshot = malloc(sizeof(_xcwm_snapshot)
+                      + context->num_stacking
+                      * sizeof(xcwm_snapshot_window_t));
+    assert(snapshot);
+    states = (xcwm_snapshot_window_t *)(snapshot + 1);
+
+    for (i = 0; i < context->num_stacking; i++) {
+        window_state_read(context->stacking[i], &states[i]);
+    }
+
+    snapshot->refs = 1;         /* The context's reference */
+    snapshot->pub.generation = ++context->snapshot_generation;
+    snapshot->pub.num_windows = context->num_stacking;
+    snapshot->pub.windows = states;
+
+    old = context->snapshot;
+    context->snapshot = snapshot;
+
+    return old;
+}
+
+xcwm_snapshot_t const *
+xcwm_snapshot_get(xcwm_context_t *context)
+{
+    _xcwm_snapshot *snapshot;
+    _xcwm_snapshot *old = NULL;
+
+    pthread_mutex_lock(&context->snapshot_lock);
+
+    /* Include changes made since the event loop last made one, such
+     * as damage removed by the client */
+    if (context->snapshot) {
+        old = snapshot_make(context);
+    }
+
+    snapshot = context->snapshot;
+    if (snapshot) {
+        __atomic_add_fetch(&snapshot->refs, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&context->snapshot_lock);
+
+    if (old) {
+        snapshot_unref(old);
+    }
+
+    return snapshot ? &snapshot->pub : NULL;
+}
+
+xcwm_snapshot_t const *
+xcwm_snapshot_ref(xcwm_snapshot_t const *snapshot)
+{
+    __atomic_add_fetch(&snapshot_from_pub(snapshot)->refs, 1,
+                       __ATOMIC_RELAXED);
+    return snapshot;
+}
+
+void
+xcwm_snapshot_unref(xcwm_snapshot_t const *snapshot)
+{
+    if (snapshot) {
+        snapshot_unref(snapshot_from_pub(snapshot));
+    }
+}
+
+void
+_xcwm_snapshot_publish(xcwm_context_t *context)
+{
+    _xcwm_snapshot *old;
+
+    /* Nothing has changed, the usual case */
+    if (!__atomic_load_n(&context->snapshot_dirty, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    pthread_mutex_lock(&context->snapshot_lock);
+    old = snapshot_make(context);
+    pthread_mutex_unlock(&context->snapshot_lock);
+
+    if (old) {
+        snapshot_unref(old);
+    }
+}
+
+void
+_xcwm_snapshot_changed(xcwm_context_t *context)
+{
+    __atomic_store_n(&context->snapshot_dirty, 1, __ATOMIC_RELEASE);
+}
+
+void
+_xcwm_snapshot_release(xcwm_context_t *context)
+{
+    if (context->snapshot) {
+        snapshot_unref(context->snapshot);
+        context->snapshot = NULL;
+    }
+    free(context->stacking);
+    context->stacking = NULL;
+    context->num_stacking = 0;
+    context->max_stacking = 0;
+}
+
+/* Find a managed window in the stacking order, -1 if it isn't there */
+static int
+stacking_find(xcwm_context_t *context, xcb_window_t window_id)
+{
+    xcwm_window_t *window =
+        _xcwm_get_window_node_by_window_id(context, window_id);
+
+    return window ? window->stacking_index : -1;
+}
+
+/* Note the positions of the windows from i up */
+static void
+stacking_reindex(xcwm_context_t *context, int i)
+{
+    for (; i < context->num_stacking; i++) {
+        context->stacking[i]->stacking_index = i;
+    }
+}
+
+static void
+stacking_insert(xcwm_context_t *context, xcwm_window_t *window, int i)
+{
+    if (context->num_stacking == context->max_stacking) {
+        int max = context->max_stacking ? context->max_stacking * 2 : 16;
+        xcwm_window_t **stacking =
+            realloc(context->stacking, max * sizeof(xcwm_window_t *));
+        assert(stacking);
+        context->stacking = stacking;
+        context->max_stacking = max;
+    }
+
+    memmove(&context->stacking[i + 1], &context->stacking[i],
+            (context->num_stacking - i) * sizeof(xcwm_window_t *));
+    context->stacking[i] = window;
+    context->num_stacking++;
+    stacking_reindex(context, i);
+}
+
+static void
+stacking_delete(xcwm_context_t *context, int i)
+{
+    context->stacking[i]->stacking_index = -1;
+    context->num_stacking--;
+    memmove(&context->stacking[i], &context->stacking[i + 1],
+            (context->num_stacking - i) * sizeof(xcwm_window_t *));
+    stacking_reindex(context, i);
+}
+
+void
+_xcwm_stacking_add(xcwm_window_t *window)
+{
+    xcwm_context_t *context = window->context;
+    int i;
+
+    /* Everything about the window is new */
+    _xcwm_snapshot_window_changed(window, 1);
+
+    pthread_mutex_lock(&context->snapshot_lock);
+    i = stacking_find(context, window->window_id);
+
+    /* A window replacing one with the same id takes its place */
+    if (i >= 0) {
+        context->stacking[i]->stacking_index = -1;
+        context->stacking[i] = window;
+        window->stacking_index = i;
+    } else {
+        stacking_insert(context, window, context->num_stacking);
+    }
+    pthread_mutex_unlock(&context->snapshot_lock);
+
+    /* Again, as a snapshot may have been made before it was added */
+    _xcwm_snapshot_changed(context);
+}
+
+void
+_xcwm_stacking_remove(xcwm_window_t *window)
+{
+    xcwm_context_t *context = window->context;
+    int i = window->stacking_index;
+
+    if (i >= 0) {
+        pthread_mutex_lock(&context->snapshot_lock);
+        stacking_delete(context, i);
+        pthread_mutex_unlock(&context->snapshot_lock);
+        _xcwm_snapshot_changed(context);
+    }
+}
+
+void
+_xcwm_stacking_restack(xcwm_window_t *window, xcb_window_t above_sibling)
+{
+    xcwm_context_t *context = window->context;
+    int i = window->stacking_index;
+    int sibling;
+
+    if (i < 0) {
+        return;
+    }
+
+    if (above_sibling == XCB_NONE) {
+        sibling = -1;
+    } else {
+        sibling = stacking_find(context, above_sibling);
+
+        /* Stacked above a window we don't manage, so we can't tell
+         * where it is relative to the others */
+        if (sibling < 0) {
+            return;
+        }
+    }
+
+    /* Already in place */
+    if (i == sibling + 1) {
+        return;
+    }
+
+    pthread_mutex_lock(&context->snapshot_lock);
+    stacking_delete(context, i);
+    if (sibling > i) {
+        sibling--;
+    }
+    stacking_insert(context, window, sibling + 1);
+    pthread_mutex_unlock(&context->snapshot_lock);
+    _xcwm_snapshot_changed(context);
+}
@@ -29,6 +29,7 @@
 
 #include "xcwm_internal.h"
 #include <xcb/xcb.h>
+#include <time.h>
 
 xcb_get_window_attributes_reply_t *
 _xcwm_get_window_attributes(xcb_connection_t *conn, xcb_window_t window)
@@ -127,6 +128,78 @@ _xcwm_write_window_info(xcb_connection_t *conn, xcb_window_t window)
     free(attr_reply);
 }
 
+uint64_t
+_xcwm_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void
+_xcwm_flush(xcwm_context_t *context)
+{
+    /* Only requests from the thread with the batch open are held back,
+     * not those the event thread sends for itself */
+    if (pthread_getspecific(context->batch_depth)) {
+        context->stats.flushes_deferred++;
+        return;
+    }
+
+    xcb_flush(context->conn);
+    context->stats.flushes++;
+}
+
+void
+_xcwm_request_track(xcwm_context_t *context, xcb_void_cookie_t cookie,
+                    xcb_window_t window, uint32_t resource,
+                    xcwm_error_op_t op)
+{
+    _xcwm_tracked_request *request;
+
+    pthread_mutex_lock(&context->tracked_lock);
+    request = &context->tracked[context->num_tracked
+                                % _XCWM_TRACKED_REQUESTS];
+    request->sequence = cookie.sequence;
+    request->window = window;
+    request->resource = resource;
+    request->op = op;
+    context->num_tracked++;
+    pthread_mutex_unlock(&context->tracked_lock);
+}
+
+int
+_xcwm_request_find(xcwm_context_t *context, xcb_generic_error_t const *error,
+                   _xcwm_tracked_request *request)
+{
+    unsigned int count;
+    unsigned int i;
+    int found = 0;
+
+    pthread_mutex_lock(&context->tracked_lock);
+    count = context->num_tracked;
+    if (count > _XCWM_TRACKED_REQUESTS) {
+        count = _XCWM_TRACKED_REQUESTS;
+    }
+
+    /* Most recent first */
+    for (i = 1; i <= count; i++) {
+        _xcwm_tracked_request *tracked =
+            &context->tracked[(context->num_tracked - i)
+                              % _XCWM_TRACKED_REQUESTS];
+
+        if (tracked->sequence == error->full_sequence) {
+            *request = *tracked;
+            found = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&context->tracked_lock);
+
+    return found;
+}
+
 int
 _xcwm_request_check(xcb_connection_t *conn, xcb_void_cookie_t cookie,
                     const char *msg)
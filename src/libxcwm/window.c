@@ -47,9 +47,14 @@ set_wm_size_hints_for_window(xcb_connection_t *conn, xcwm_window_t *window);
 void
 init_damage_on_window(xcb_connection_t *conn, xcwm_window_t *window);
 
-/* Initialize reshape on a window */
+/* Remove the damage which has been copied from a locked window */
 static void
-init_shape_on_window(xcb_connection_t *conn, xcwm_window_t *window);
+remove_damage(xcwm_window_t *window);
+
+/* Set the shape of the window from a shape rectangles reply */
+static void
+set_shape_from_reply(xcwm_window_t *window,
+                     xcb_shape_get_rectangles_reply_t *reply);
 
 /* Set window to the top of the stack */
 void
@@ -81,49 +86,159 @@ xcwm_window_set_input_focus(xcwm_window_t *window)
 {
     xcb_set_input_focus(window->context->conn, XCB_INPUT_FOCUS_PARENT,
                         window->window_id, XCB_CURRENT_TIME);
-    xcb_flush(window->context->conn);
+    _xcwm_flush(window->context);
 }
 
 xcwm_window_t *
 _xcwm_window_create(xcwm_context_t *context, xcb_window_t new_window,
                      xcb_window_t parent)
 {
+    _xcwm_window_create_t create;
 
-    /* Check to see if the window is already being managed */
-    if (_xcwm_get_window_node_by_window_id(new_window)) {
+    if (!_xcwm_window_create_begin(context, new_window, parent, &create)) {
         return NULL;
     }
 
-    /* Ignore InputOnly windows */
-    xcb_get_window_attributes_reply_t *attrs =
-        _xcwm_get_window_attributes(context->conn, new_window);
-    if ((!attrs) || (attrs->_class == XCB_WINDOW_CLASS_INPUT_ONLY))
-        return NULL;
+    return _xcwm_window_create_finish(&create);
+}
 
-    xcb_get_geometry_reply_t *geom;
-    geom = _xcwm_get_window_geometry(context->conn, new_window);
-    if (!geom)
-        return NULL;
+int
+_xcwm_window_create_begin(xcwm_context_t *context, xcb_window_t new_window,
+                          xcb_window_t parent, _xcwm_window_create_t *create)
+{
+    xcb_connection_t *conn = context->conn;
+
+    /* Check to see if the window is already being managed */
+    if (_xcwm_get_window_node_by_window_id(context, new_window)) {
+        return 0;
+    }
 
     /* allocate memory for new xcwm_window_t and rectangles */
     xcwm_window_t *window = malloc(sizeof(xcwm_window_t));
     assert(window);
 
-    /* set any available values from xcb_create_notify_event_t object pointer
-       and geom pointer */
     window->context = context;
     window->window_id = new_window;
-    window->bounds.x = geom->x;
-    window->bounds.y = geom->y;
-    window->bounds.width = geom->width;
-    window->bounds.height = geom->height;
+    window->refs = 1;
+    _xcwm_window_lock_init(window);
+    memset(&window->dmg_stats, 0, sizeof(_xcwm_damage_stats));
+    window->damage_interval = 0;
+    window->damage_interval_set = 0;
+    window->next_damage = 0;
+    window->name = NULL;
     window->opacity = ~0;
     window->composite_pixmap_id = 0;
     window->local_data = 0;
     window->shape = 0;
+    window->damage_mode = context->damage_mode;
+    window->dmg_parts = 0;
+    window->num_dmg_fetches = 0;
+    window->dmg_removed = 0;
+    window->shm_seg = 0;
+    window->shm_addr = NULL;
+    window->shm_size = 0;
+    window->shm_busy = 0;
+    window->shm_closed = 0;
+    window->snapshot_seq = 0;
+    window->stacking_index = -1;
+    window->shadow = NULL;
+    _xcwm_region_init(&window->dmg_region);
+    _xcwm_region_init(&window->dmg_captured);
+    window->pending = 0;
+    window->pending_atoms = NULL;
+    window->num_pending_atoms = 0;
+    window->max_pending_atoms = 0;
+
+    create->window = window;
+    create->parent = parent;
+
+    /* Send all the requests to set up the window before waiting for
+     * any reply, so this costs one round trip rather than one per
+     * request. Requests without replies are not checked, any error is
+     * reported by the event loop. If the window turns out not to be
+     * one we manage, this is undone when finishing. */
+    create->attrs_cookie = xcb_get_window_attributes(conn, new_window);
+    create->geom_cookie = xcb_get_geometry(conn, new_window);
+
+    /* Set the event masks for the window */
+    set_window_event_masks(conn, window);
+
+    /* register for damage */
+    init_damage_on_window(conn, window);
+
+    /* register for re-shape */
+    _xcwm_request_track(context,
+                        xcb_shape_select_input(conn, new_window,
+                                               1 /* ShapeNotify */),
+                        new_window, new_window, XCWM_ERROR_OP_SHAPE_SELECT);
+
+    /* Get the ICCCM properties we care about */
+    create->atoms_request = _xcwm_atoms_request_window(window);
+
+    /* Get the shape */
+    create->shape_rects_cookie =
+        xcb_shape_get_rectangles(conn, new_window, XCB_SHAPE_SK_BOUNDING);
+
+    return 1;
+}
+
+xcwm_window_t *
+_xcwm_window_create_finish(_xcwm_window_create_t *create)
+{
+    xcwm_window_t *window = create->window;
+    xcwm_context_t *context = window->context;
+    xcb_connection_t *conn = context->conn;
+    xcb_get_window_attributes_reply_t *attrs;
+    xcb_get_geometry_reply_t *geom;
+    xcb_generic_error_t *error;
+
+    /* Ignore InputOnly windows, and windows which have already gone */
+    attrs = xcb_get_window_attributes_reply(conn, create->attrs_cookie,
+                                            &error);
+    if (error) {
+        fprintf(stderr, "ERROR: Failed to get window attributes: %d\n",
+                error->error_code);
+        free(error);
+    }
+    geom = xcb_get_geometry_reply(conn, create->geom_cookie, NULL);
+    if (!attrs || !geom || attrs->_class == XCB_WINDOW_CLASS_INPUT_ONLY) {
+        uint32_t values[1] = { 0 };
+
+        free(geom);
+
+        _xcwm_atoms_discard_window(context, create->atoms_request);
+        xcb_discard_reply(conn, create->shape_rects_cookie.sequence);
+
+        if (window->damage) {
+            xcb_damage_destroy(conn, window->damage);
+        }
+        if (window->dmg_parts) {
+            xcb_xfixes_destroy_region(conn, window->dmg_parts);
+        }
+
+        /* If the window still exists, stop listening to it */
+        if (attrs) {
+            xcb_change_window_attributes(conn, window->window_id,
+                                         XCB_CW_EVENT_MASK, values);
+            free(attrs);
+        }
+
+        pthread_mutex_destroy(&window->lock);
+        free(window);
+        return NULL;
+    }
+
+    /* set any available values from geom pointer */
+    window->bounds.x = geom->x;
+    window->bounds.y = geom->y;
+    window->bounds.width = geom->width;
+    window->bounds.height = geom->height;
+    window->border_width = geom->border_width;
+    window->above_sibling = XCB_NONE;
 
     /* Find and set the parent */
-    window->parent = _xcwm_get_window_node_by_window_id(parent);
+    window->parent = _xcwm_get_window_node_by_window_id(context,
+                                                        create->parent);
     free(geom);
 
     /* Get value of override_redirect flag */
@@ -138,20 +253,17 @@ _xcwm_window_create(xcwm_context_t *context, xcb_window_t new_window,
     }
     free(attrs);
 
-    /* Set the event masks for the window */
-    set_window_event_masks(context->conn, window);
-
     /* Set the ICCCM properties we care about */
-    _xcwm_atoms_init_window(window);
-
-    /* register for damage */
-    init_damage_on_window(context->conn, window);
+    _xcwm_atoms_reply_window(window, create->atoms_request);
 
-    /* note the shape, and register for re-shape */
-    _xcwm_window_set_shape(window, 1);
-    init_shape_on_window(context->conn, window);
+    /* note the shape */
+    set_shape_from_reply(window,
+                         xcb_shape_get_rectangles_reply(
+                             conn, create->shape_rects_cookie, NULL));
 
-    /* add window to window list for this context */
+    /* add window to the stacking order, taking the place of any window
+     * with the same ID, and to the window list for this context */
+    _xcwm_stacking_add(window);
     window = _xcwm_add_window(window);
 
     /* Set the WM_STATE of the window to normal */
@@ -161,21 +273,32 @@ _xcwm_window_create(xcwm_context_t *context, xcb_window_t new_window,
 }
 
 xcwm_window_t *
-_xcwm_window_remove(xcb_connection_t *conn, xcb_window_t window)
+_xcwm_window_remove(xcwm_context_t *context, xcb_window_t window)
 {
 
     xcwm_window_t *removed =
-        _xcwm_get_window_node_by_window_id(window);
+        _xcwm_get_window_node_by_window_id(context, window);
     if (!removed) {
         /* Window isn't being managed */
         return NULL;
     }
 
+    _xcwm_stacking_remove(removed);
+
     /* Destroy the damage object associated with the window. */
-    xcb_damage_destroy(conn, removed->damage);
+    if (removed->damage) {
+        xcb_damage_destroy(context->conn, removed->damage);
+    }
+    if (removed->dmg_parts) {
+        xcb_xfixes_destroy_region(context->conn, removed->dmg_parts);
+    }
+    if (removed->dmg_removed) {
+        xcb_xfixes_destroy_region(context->conn, removed->dmg_removed);
+    }
+    _xcwm_image_shm_release(removed);
 
     /* Remove window from window list for this context */
-    _xcwm_remove_window_node(removed->window_id);
+    _xcwm_remove_window_node(context, removed->window_id);
 
     /* Return the pointer to the window that was removed from the list. */
     return removed;
@@ -185,6 +308,9 @@ void
 xcwm_window_configure(xcwm_window_t *window, int x, int y,
                       int width, int height)
 {
+    xcwm_rect_t area = { 0, 0, width, height };
+
+    xcwm_window_lock(window);
 
     /* Set values for xcwm_window_t */
     window->bounds.x = x;
@@ -192,60 +318,171 @@ xcwm_window_configure(xcwm_window_t *window, int x, int y,
     window->bounds.width = width;
     window->bounds.height = height;
 
-    _xcwm_resize_window(window->context->conn, window->window_id,
+    /* Damage the whole window at its new size so its redrawn properly */
+    _xcwm_region_union_rect(&window->dmg_region, &area);
+    _xcwm_snapshot_window_changed(window, 0);
+
+    xcwm_window_unlock(window);
+
+    _xcwm_resize_window(window->context, window->window_id,
                         x, y, width, height);
-    /* Set the damage area to the new window size so its redrawn properly */
-    window->dmg_bounds.width = width;
-    window->dmg_bounds.height = height;
+    _xcwm_flush(window->context);
 }
 
 void
 xcwm_window_remove_damage(xcwm_window_t *window)
 {
-    xcb_xfixes_region_t region = xcb_generate_id(window->context->conn);
-    xcb_rectangle_t rect;
-    xcb_void_cookie_t cookie;
-
     if (!window) {
         return;
     }
 
-    rect.x = window->dmg_bounds.x;
-    rect.y = window->dmg_bounds.y;
-    rect.width = window->dmg_bounds.width;
-    rect.height = window->dmg_bounds.height;
+    xcwm_window_lock(window);
+    remove_damage(window);
+    _xcwm_snapshot_window_changed(window, 0);
+    xcwm_window_unlock(window);
+}
+
+static void
+remove_damage(xcwm_window_t *window)
+{
+    xcb_connection_t *conn;
+    xcb_rectangle_t rects[_XCWM_REGION_MAX_RECTS];
+    _xcwm_region *removed;
+    int i;
+
+    /* Only remove the damage which has been copied, anything reported
+     * since then is still to be copied. If nothing has been copied,
+     * remove all of it. */
+    if (window->dmg_captured.num_rects) {
+        removed = &window->dmg_captured;
+    } else {
+        removed = &window->dmg_region;
+    }
+    if (!removed->num_rects) {
+        return;
+    }
+
+    /* In exact mode the server's damage was emptied when it was
+     * fetched, so it only needs removing here, as it does if the
+     * window has no damage object */
+    if (window->damage_mode == XCWM_DAMAGE_MODE_EXACT || !window->damage) {
+        if (removed == &window->dmg_region) {
+            _xcwm_region_init(&window->dmg_region);
+        } else {
+            _xcwm_region_subtract(&window->dmg_region, removed);
+        }
+        _xcwm_region_init(&window->dmg_captured);
+        return;
+    }
 
-    xcb_xfixes_create_region(window->context->conn,
-                             region,
-                             1,
-                             &rect);
+    for (i = 0; i < removed->num_rects; i++) {
+        rects[i].x = removed->rects[i].x;
+        rects[i].y = removed->rects[i].y;
+        rects[i].width = removed->rects[i].width;
+        rects[i].height = removed->rects[i].height;
+    }
 
-    cookie = xcb_damage_subtract_checked(window->context->conn,
-                                         window->damage,
-                                         region,
-                                         0);
+    /* The same region is used every time, only its contents change */
+    conn = window->context->conn;
+    if (!window->dmg_removed) {
+        window->dmg_removed = xcb_generate_id(conn);
+        xcb_xfixes_create_region(conn, window->dmg_removed,
+                                 removed->num_rects, rects);
+    } else {
+        xcb_xfixes_set_region(conn, window->dmg_removed,
+                              removed->num_rects, rects);
+    }
+
+    /* Don't wait to see if this succeeded, so removing damage doesn't
+     * cost a round trip. Any error is reported by the event loop. */
+    _xcwm_request_track(window->context,
+                        xcb_damage_subtract(conn, window->damage,
+                                            window->dmg_removed, XCB_NONE),
+                        window->window_id, window->damage,
+                        XCWM_ERROR_OP_DAMAGE_SUBTRACT);
 
-    if (!(_xcwm_request_check(window->context->conn, cookie,
-                              "Failed to subtract damage"))) {
-        window->dmg_bounds.x = 0;
-        window->dmg_bounds.y = 0;
-        window->dmg_bounds.width = 0;
-        window->dmg_bounds.height = 0;
+    if (removed == &window->dmg_region) {
+        _xcwm_region_init(&window->dmg_region);
+    } else {
+        _xcwm_region_subtract(&window->dmg_region, removed);
     }
-    return;
+    _xcwm_region_init(&window->dmg_captured);
+}
+
+void
+xcwm_window_set_damage_mode(xcwm_window_t *window, xcwm_damage_mode_t mode)
+{
+    xcb_connection_t *conn = window->context->conn;
+    xcb_xfixes_region_t region;
+    xcb_rectangle_t rect;
+    xcwm_rect_t area;
+
+    /* The event loop uses the damage object and mode while handling
+     * the window's damage, so switch both with it locked */
+    xcwm_window_lock(window);
+    if (window->damage_mode == mode) {
+        xcwm_window_unlock(window);
+        return;
+    }
+
+    /* The report level can only be chosen when the damage object is
+     * created, so replace it */
+    if (window->damage) {
+        xcb_damage_destroy(window->context->conn, window->damage);
+    }
+    window->damage_mode = mode;
+    init_damage_on_window(window->context->conn, window);
+
+    /* Changes made while switching are lost, so damage everything */
+    area.x = 0;
+    area.y = 0;
+    area.width = window->bounds.width;
+    area.height = window->bounds.height;
+    _xcwm_region_union_rect(&window->dmg_region, &area);
+    _xcwm_snapshot_window_changed(window, 0);
+
+    /* Have the server report it to the new damage object too, so the
+     * event loop delivers it, paced like any other damage */
+    if (window->damage && area.width > 0 && area.height > 0) {
+        rect.x = 0;
+        rect.y = 0;
+        rect.width = area.width;
+        rect.height = area.height;
+        region = xcb_generate_id(conn);
+        xcb_xfixes_create_region(conn, region, 1, &rect);
+        xcb_damage_add(conn, window->window_id, region);
+        xcb_xfixes_destroy_region(conn, region);
+    }
+    xcwm_window_unlock(window);
+
+    _xcwm_flush(window->context);
+}
+
+xcwm_damage_mode_t
+xcwm_window_get_damage_mode(xcwm_window_t const *window)
+{
+    return window->damage_mode;
+}
+
+void
+xcwm_context_set_damage_mode(xcwm_context_t *context,
+                             xcwm_damage_mode_t mode)
+{
+    context->damage_mode = mode;
 }
 
 void
 xcwm_window_request_close(xcwm_window_t *window)
 {
     /* check to see if the window is in the list */
-    if (!_xcwm_get_window_node_by_window_id(window->window_id))
+    if (!_xcwm_get_window_node_by_window_id(window->context,
+                                            window->window_id))
         return;
 
     /* kill using xcb_kill_client */
     if (!window->wm_delete_set == 1) {
         xcb_kill_client(window->context->conn, window->window_id);
-        xcb_flush(window->context->conn);
+        _xcwm_flush(window->context);
         return;
     }
     /* kill using WM_DELETE_WINDOW */
@@ -264,7 +501,7 @@ xcwm_window_request_close(xcwm_window_t *window)
         xcb_send_event(window->context->conn, 0, window->window_id,
                        XCB_EVENT_MASK_NO_EVENT,
                        (char *)&event);
-        xcb_flush(window->context->conn);
+        _xcwm_flush(window->context);
         return;
     }
     return;
@@ -278,15 +515,191 @@ _xcwm_window_release(xcwm_window_t *window)
         return;
     }
 
+    /* Freed when the last reference is dropped */
+    if (__atomic_sub_fetch(&window->refs, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+
     if (window->shape)
         free(window->shape);
 
+    free(window->pending_atoms);
+    xcwm_shadow_disable(window);
+
     if (window->name) {
         free(window->name);
     }
+    pthread_mutex_destroy(&window->lock);
     free(window);
 }
 
+void
+_xcwm_window_lock_init(xcwm_window_t *window)
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&window->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+/* Damage statistics are averaged over periods of this length */
+#define DAMAGE_STATS_PERIOD 1000000
+
+/* Fold the periods which are over into the averages, if any are.
+ * Each period without damage halves both averages, so those of an
+ * idle window settle back to nothing. Window must be locked. */
+static void
+damage_stats_update(_xcwm_damage_stats *stats, uint64_t now)
+{
+    uint64_t periods = (now - stats->period_start) / DAMAGE_STATS_PERIOD;
+    double period_fraction = 0;
+
+    if (!periods) {
+        return;
+    }
+
+    /* The events noted were all in the first of them */
+    if (stats->period_events) {
+        period_fraction = stats->period_fraction / stats->period_events;
+    }
+    stats->rate = (stats->rate
+                   + stats->period_events * 1000000.0
+                   / DAMAGE_STATS_PERIOD) / 2;
+    stats->fraction = (stats->fraction + period_fraction) / 2;
+
+    /* The rest had none. Past this many, nothing is left. */
+    if (periods > 64) {
+        stats->rate = 0;
+        stats->fraction = 0;
+    } else {
+        while (--periods) {
+            stats->rate /= 2;
+            stats->fraction /= 2;
+        }
+    }
+
+    stats->period_start = now - (now - stats->period_start)
+        % DAMAGE_STATS_PERIOD;
+    stats->period_events = 0;
+    stats->period_fraction = 0;
+}
+
+void
+_xcwm_window_note_damage(xcwm_window_t *window, long area, uint64_t now)
+{
+    _xcwm_damage_stats *stats = &window->dmg_stats;
+    long window_area = (long)window->bounds.width * window->bounds.height;
+
+    damage_stats_update(stats, now);
+
+    stats->period_events++;
+    stats->events++;
+    if (window_area > 0) {
+        stats->period_fraction += area < window_area ?
+            (double)area / window_area : 1.0;
+    }
+}
+
+void
+xcwm_window_get_damage_stats(xcwm_window_t *window,
+                             xcwm_damage_stats_t *stats)
+{
+    xcwm_window_lock(window);
+    damage_stats_update(&window->dmg_stats, _xcwm_time_us());
+    stats->events_per_second = window->dmg_stats.rate;
+    stats->damaged_fraction = window->dmg_stats.fraction;
+    stats->events = window->dmg_stats.events;
+    xcwm_window_unlock(window);
+}
+
+/* Windows damaging at least this much of their area each time are
+ * copied in full */
+#define CAPTURE_FULL_FRACTION 0.5
+/* As are windows damaging this often, and at least this much */
+#define CAPTURE_FULL_RATE 30.0
+#define CAPTURE_FULL_RATE_FRACTION 0.25
+/* Damage of windows copied in full is delivered at most this often,
+ * unless the client has set a limit */
+#define CAPTURE_FULL_FPS 30
+
+xcwm_capture_strategy_t
+xcwm_window_get_capture_strategy(xcwm_window_t *window)
+{
+    xcwm_capture_strategy_t strategy = XCWM_CAPTURE_BOUNDING_BOX;
+    xcwm_damage_stats_t stats;
+    long rects_area = 0;
+    long extents_area;
+    int full;
+    int i;
+
+    xcwm_window_get_damage_stats(window, &stats);
+    full = stats.damaged_fraction >= CAPTURE_FULL_FRACTION
+        || (stats.events_per_second >= CAPTURE_FULL_RATE
+            && stats.damaged_fraction >= CAPTURE_FULL_RATE_FRACTION);
+
+    xcwm_window_lock(window);
+
+    /* Throttle full copies, and stop once they are no longer needed */
+    if (!window->damage_interval_set) {
+        window->damage_interval = full ? 1000000 / CAPTURE_FULL_FPS : 0;
+    }
+    if (full) {
+        xcwm_window_unlock(window);
+        return XCWM_CAPTURE_FULL;
+    }
+
+    /* Copy the rectangles separately if most of the bounding box
+     * hasn't changed */
+    extents_area = (long)window->dmg_region.extents.width
+        * window->dmg_region.extents.height;
+    for (i = 0; i < window->dmg_region.num_rects; i++) {
+        rects_area += (long)window->dmg_region.rects[i].width
+            * window->dmg_region.rects[i].height;
+    }
+    if (window->dmg_region.num_rects > 1 && rects_area * 2 < extents_area) {
+        strategy = XCWM_CAPTURE_EXACT;
+    }
+    xcwm_window_unlock(window);
+
+    return strategy;
+}
+
+void
+xcwm_window_set_max_fps(xcwm_window_t *window, unsigned int fps)
+{
+    xcwm_window_lock(window);
+    window->damage_interval = fps ? 1000000 / fps : 0;
+    window->damage_interval_set = 1;
+    xcwm_window_unlock(window);
+}
+
+xcwm_window_t *
+xcwm_window_ref(xcwm_window_t *window)
+{
+    __atomic_add_fetch(&window->refs, 1, __ATOMIC_RELAXED);
+    return window;
+}
+
+void
+xcwm_window_unref(xcwm_window_t *window)
+{
+    _xcwm_window_release(window);
+}
+
+void
+xcwm_window_lock(xcwm_window_t *window)
+{
+    pthread_mutex_lock(&window->lock);
+}
+
+void
+xcwm_window_unlock(xcwm_window_t *window)
+{
+    pthread_mutex_unlock(&window->lock);
+}
+
 /* Accessor functions into xcwm_window_t */
 
 xcb_window_t
@@ -352,11 +765,39 @@ xcwm_window_get_full_rect(xcwm_window_t const *window)
     return &(window->bounds);
 }
 
+int
+xcwm_window_get_border_width(xcwm_window_t const *window)
+{
+
+    return window->border_width;
+}
+
+xcb_window_t
+xcwm_window_get_above_sibling_id(xcwm_window_t *window)
+{
+    xcb_window_t above_sibling;
+
+    /* Changed by the event loop with the window locked */
+    xcwm_window_lock(window);
+    above_sibling = window->above_sibling;
+    xcwm_window_unlock(window);
+
+    return above_sibling;
+}
+
 const xcwm_rect_t *
 xcwm_window_get_damaged_rect(xcwm_window_t const *window)
 {
 
-    return &(window->dmg_bounds);
+    return &(window->dmg_region.extents);
+}
+
+const xcwm_rect_t *
+xcwm_window_get_damaged_rects(xcwm_window_t const *window, int *count)
+{
+
+    *count = window->dmg_region.num_rects;
+    return window->dmg_region.rects;
 }
 
 char *
@@ -542,13 +983,13 @@ xcwm_window_deiconify(xcwm_window_t *window)
 
 /* Resize the window on server side */
 void
-_xcwm_resize_window(xcb_connection_t *conn, xcb_window_t window,
+_xcwm_resize_window(xcwm_context_t *context, xcb_window_t window,
                     int x, int y, int width, int height)
 {
 
     uint32_t values[] = { x, y, width, height, 0 };
 
-    xcb_configure_window(conn,
+    xcb_configure_window(context->conn,
                          window,
                          XCB_CONFIG_WINDOW_X |
                          XCB_CONFIG_WINDOW_Y |
@@ -556,7 +997,6 @@ _xcwm_resize_window(xcb_connection_t *conn, xcb_window_t window,
                          XCB_CONFIG_WINDOW_HEIGHT |
                          XCB_CONFIG_WINDOW_BORDER_WIDTH,
                          values);
-    xcb_flush(conn);
 }
 
 void
@@ -571,49 +1011,39 @@ set_window_event_masks(xcb_connection_t *conn, xcwm_window_t *window)
 void
 init_damage_on_window(xcb_connection_t *conn, xcwm_window_t *window)
 {
-    xcb_damage_damage_t damage_id;
     uint8_t level;
-    xcb_void_cookie_t cookie;
-
-    damage_id = xcb_generate_id(conn);
-
-    level = XCB_DAMAGE_REPORT_LEVEL_BOUNDING_BOX;
-    cookie = xcb_damage_create(conn,
-                               damage_id,
-                               window->window_id,
-                               level);
-
-    if (_xcwm_request_check(conn, cookie,
-                            "Could not create damage for window")) {
-        window->damage = 0;
-        return;
-    }
 
     /* Assign this damage object to the window */
-    window->damage = damage_id;
+    window->damage = xcb_generate_id(conn);
 
-    /* Initialize the damaged area in the window to zero */
-    window->dmg_bounds.x = 0;
-    window->dmg_bounds.y = 0;
-    window->dmg_bounds.width = 0;
-    window->dmg_bounds.height = 0;
-}
+    /* In exact mode, we only need to know when the damage becomes
+     * non-empty, the damaged region is then fetched */
+    if (window->damage_mode == XCWM_DAMAGE_MODE_EXACT) {
+        level = XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY;
+    } else {
+        level = XCB_DAMAGE_REPORT_LEVEL_BOUNDING_BOX;
+    }
 
-void
-init_shape_on_window(xcb_connection_t *conn, xcwm_window_t *window)
-{
-    xcb_void_cookie_t cookie = xcb_shape_select_input(conn, window->window_id, 1 /* ShapeNotify */);
+    /* In exact mode the damage is moved into this region to be
+     * fetched */
+    if (window->damage_mode == XCWM_DAMAGE_MODE_EXACT && !window->dmg_parts) {
+        window->dmg_parts = xcb_generate_id(conn);
+        xcb_xfixes_create_region(conn, window->dmg_parts, 0, NULL);
+    }
 
-    _xcwm_request_check(conn, cookie,
-                        "Could not select shape events on window");
+    /* If this fails, the event loop clears window->damage */
+    _xcwm_request_track(window->context,
+                        xcb_damage_create(conn,
+                                          window->damage,
+                                          window->window_id,
+                                          level),
+                        window->window_id, window->damage,
+                        XCWM_ERROR_OP_DAMAGE_CREATE);
 }
 
 void
 _xcwm_window_set_shape(xcwm_window_t *window, uint8_t shaped)
 {
-    if (window->shape)
-        free(window->shape);
-
     /* If shaped == FALSE, window is unshaped and we don't need to ask to find shaped region */
     if (shaped)
     {
@@ -621,26 +1051,42 @@ _xcwm_window_set_shape(xcwm_window_t *window, uint8_t shaped)
                                                                             window->window_id,
                                                                             XCB_SHAPE_SK_BOUNDING);
 
-        xcb_shape_get_rectangles_reply_t *reply = xcb_shape_get_rectangles_reply(window->context->conn,
-                                                                                cookie,
-                                                                                NULL);
-
-        /* ... but unfortunately, there is no way to ask if a window is shaped initially, so
-           we have to check if we got exactly 1 rectangle which is the same as the window bounds
-           and treat that as unshaped, as well */
-        xcb_rectangle_iterator_t ri = xcb_shape_get_rectangles_rectangles_iterator(reply);
-        if ((ri.rem == 0) ||
-            ((ri.rem == 1) && (ri.data->x <= 0) && (ri.data->y <= 0)
-             && (ri.data->width >= window->bounds.width) && (ri.data->height >= window->bounds.height))) {
-            printf("window 0x%08x is actually unshaped\n", window->window_id);
-            window->shape = 0;
-            free(reply);
-        } else
-        {
-            window->shape = reply;
-        }
+        set_shape_from_reply(window,
+                             xcb_shape_get_rectangles_reply(window->context->conn,
+                                                            cookie,
+                                                            NULL));
     } else
     {
+        if (window->shape)
+            free(window->shape);
         window->shape = 0;
     }
 }
+
+static void
+set_shape_from_reply(xcwm_window_t *window,
+                     xcb_shape_get_rectangles_reply_t *reply)
+{
+    if (window->shape)
+        free(window->shape);
+
+    if (!reply) {
+        window->shape = 0;
+        return;
+    }
+
+    /* ... but unfortunately, there is no way to ask if a window is shaped initially, so
+       we have to check if we got exactly 1 rectangle which is the same as the window bounds
+       and treat that as unshaped, as well */
+    xcb_rectangle_iterator_t ri = xcb_shape_get_rectangles_rectangles_iterator(reply);
+    if ((ri.rem == 0) ||
+        ((ri.rem == 1) && (ri.data->x <= 0) && (ri.data->y <= 0)
+         && (ri.data->width >= window->bounds.width) && (ri.data->height >= window->bounds.height))) {
+        printf("window 0x%08x is actually unshaped\n", window->window_id);
+        window->shape = 0;
+        free(reply);
+    } else
+    {
+        window->shape = reply;
+    }
+}
@@ -31,11 +31,13 @@
 #include <string.h>
 #include <assert.h>
 #include <limits.h>
+#include <pthread.h>
 #include <xcb/xcb.h>
 #include <xcb/xcb_image.h>
 #include <xcb/xcb_icccm.h>
 #include <xcb/xcb_ewmh.h>
 #include <xcb/xcb_atom.h>
+#include <xcb/xfixes.h>
 #include <xcwm/xcwm.h>
 
 /**
@@ -58,6 +60,75 @@ struct xcwm_wm_atoms_t {
 };
 typedef struct xcwm_wm_atoms_t xcwm_wm_atoms_t;
 
+/**
+ * An open-addressing hash table, keyed by window id, holding
+ * pointers to the managed windows. Collisions are resolved by linear
+ * probing.
+ */
+typedef struct _xcwm_window_table {
+    struct xcwm_window_t **slots; /**< Window pointers, NULL if empty */
+    unsigned int size;            /**< Number of slots, a power of two */
+    unsigned int count;           /**< Number of windows in the table */
+} _xcwm_window_table;
+
+/* Maximum number of rectangles held in a _xcwm_region */
+#define _XCWM_REGION_MAX_RECTS 16
+
+/**
+ * A bounded list of rectangles, used to accumulate damage client side.
+ */
+typedef struct _xcwm_region {
+    int num_rects;
+    xcwm_rect_t rects[_XCWM_REGION_MAX_RECTS];
+    xcwm_rect_t extents;        /* Bounding box of all the rectangles */
+} _xcwm_region;
+
+/* Defined in atoms.c */
+struct xcwm_property_table_t;
+
+/* Most damage region fetches left waiting for their replies per window */
+#define _XCWM_DAMAGE_FETCHES 4
+
+/* Kinds of change which can be pending delivery at the end of a batch */
+#define _XCWM_PENDING_DAMAGE    (1 << 0)
+#define _XCWM_PENDING_PROPERTY  (1 << 1)
+#define _XCWM_PENDING_CONFIGURE (1 << 2)
+
+/* Ring of event records, see event_ring.c */
+typedef struct _xcwm_event_ring {
+    xcwm_event_record_t *records;
+    unsigned int mask;          /* Number of records - 1 */
+    unsigned int head;          /* Next to write, only the producer stores */
+    unsigned int tail;          /* Next to read, only the consumer stores */
+} _xcwm_event_ring;
+
+/* A snapshot and its reference count, see snapshot.c */
+typedef struct _xcwm_snapshot {
+    int refs;
+    xcwm_snapshot_t pub;        /* What the client sees */
+} _xcwm_snapshot;
+
+/* Number of requests whose errors can be traced back to their window */
+#define _XCWM_TRACKED_REQUESTS 256
+
+/* A request which can fail, and what it was made for */
+typedef struct _xcwm_tracked_request {
+    unsigned int sequence;      /* Sequence number of the request */
+    xcb_window_t window;        /* Window it was made for */
+    uint32_t resource;          /* Resource it created or used */
+    xcwm_error_op_t op;
+} _xcwm_tracked_request;
+
+/* Damage statistics of a window, see _xcwm_window_note_damage() */
+typedef struct _xcwm_damage_stats {
+    uint64_t period_start;      /* When the current period started */
+    unsigned long period_events; /* Events in the current period */
+    double period_fraction;     /* Sum of their damaged fractions */
+    double rate;                /* Average events per second */
+    double fraction;            /* Average damaged fraction */
+    unsigned long events;       /* Events in total */
+} _xcwm_damage_stats;
+
 /**
  * Structure to hold connection data
  */
@@ -68,8 +139,51 @@ struct xcwm_context_t {
     int damage_event_mask;
     int shape_event;
     int fixes_event_base;
+    int shm_present;            /* 1 if MIT-SHM can be used for images */
     xcb_window_t wm_cm_window;
     xcwm_wm_atoms_t atoms;
+    _xcwm_window_table windows;         /* Windows managed on this context */
+    struct xcwm_property_table_t *property_table; /* Properties we take
+                                                   * note of */
+    pthread_mutex_t property_table_lock; /* Serializes replacing it */
+    xcwm_event_cb_t event_callback;     /* Client's event callback */
+    xcwm_error_cb_t error_callback;     /* Client's error callback */
+    _xcwm_event_ring *event_ring;       /* Events go here, if set */
+    struct xcwm_window_t **stacking;    /* Managed windows, bottom first,
+                                         * changed with snapshot_lock */
+    int num_stacking;
+    int max_stacking;
+    _xcwm_snapshot *snapshot;           /* Latest snapshot */
+    pthread_mutex_t snapshot_lock;      /* Held to make or reference it */
+    int snapshot_dirty;                 /* 1 if a new one is needed */
+    unsigned long snapshot_generation;
+    _xcwm_tracked_request tracked[_XCWM_TRACKED_REQUESTS]; /* Most recent
+                                                            * requests
+                                                            * which can
+                                                            * fail */
+    unsigned int num_tracked;           /* Ever tracked, wraps */
+    pthread_mutex_t tracked_lock;
+    pthread_t event_thread;             /* Thread running the event loop */
+    int event_stop;                     /* Set to 1 to stop the thread */
+    int event_shared;                   /* 1 if serviced by shared loop */
+    int event_prepared;                 /* 1 once dispatch has adopted */
+    int event_batching;                 /* 1 to coalesce event batches */
+    unsigned long frame_interval;       /* Microseconds between damage
+                                         * deliveries, 0 if not paced */
+    uint64_t next_frame;                /* Monotonic time damage may next
+                                         * be delivered, microseconds */
+    xcwm_damage_mode_t damage_mode;     /* Damage mode for new windows */
+    struct xcwm_window_t **pending_windows; /* Windows with changes
+                                             * pending in this batch */
+    int num_pending_windows;
+    int max_pending_windows;
+    unsigned long batch_events;         /* Raw events in this batch */
+    unsigned long batch_merged;         /* Of which merged */
+    unsigned long batch_property_events; /* PropertyNotify in this batch */
+    pthread_key_t batch_depth;          /* Request batches open on the
+                                         * calling thread */
+    xcwm_context_stats_t stats;
+    pthread_mutex_t event_thread_lock;  /* Lock supplied to client */
 };
 
 /**
@@ -77,13 +191,24 @@ struct xcwm_context_t {
  */
 struct xcwm_window_t {
     xcb_drawable_t window_id;
+    pthread_mutex_t lock;       /* Protects damage and bounds, recursive */
+    int refs;                   /* References held, by the context while
+                                 * the window is managed, and by clients */
     xcwm_context_t *context;
     xcwm_window_type_t type;    /* The type of this window */
     struct xcwm_window_t *parent;
     struct xcwm_window_t *transient_for; /* Window this one is transient for */
     xcb_damage_damage_t damage;
-    xcwm_rect_t bounds;
-    xcwm_rect_t dmg_bounds;
+    xcwm_damage_mode_t damage_mode;
+    xcb_xfixes_region_t dmg_parts; /* Receives damage in exact mode */
+    xcb_xfixes_fetch_region_cookie_t dmg_fetches[_XCWM_DAMAGE_FETCHES];
+    int num_dmg_fetches;        /* Fetches of dmg_parts to collect */
+    xcb_xfixes_region_t dmg_removed; /* Damage to subtract, reused */
+    xcwm_rect_t bounds;         /* Kept up to date by ConfigureNotify */
+    uint16_t border_width;
+    xcb_window_t above_sibling; /* Sibling stacked immediately below */
+    _xcwm_region dmg_region;    /* Damage accumulated since last removed */
+    _xcwm_region dmg_captured;  /* Damage copied since last removed */
     xcb_size_hints_t size_hints; /* WM_NORMAL_HINTS */
     char *name;         /* The name of the window */
     int wm_delete_set;  /* Flag for WM_DELETE_WINDOW, 1 if set */
@@ -92,15 +217,32 @@ struct xcwm_window_t {
     void *local_data;   /* Area for data client cares about */
     unsigned int opacity;
     xcb_pixmap_t composite_pixmap_id;
+    uint16_t pixmap_width;      /* Size composite_pixmap_id was named at */
+    uint16_t pixmap_height;
+    uint16_t pixmap_border_width;
+    uint32_t shm_seg;           /* MIT-SHM segment images are read into */
+    void *shm_addr;
+    size_t shm_size;
+    int shm_busy;               /* 1 while an image uses it, locked */
+    int shm_closed;             /* 1 once it may no longer be used */
+    struct _xcwm_shadow *shadow; /* Shadow buffer, if enabled */
+    xcwm_snapshot_window_t snapshot_state; /* As snapshots show it */
+    unsigned int snapshot_seq;  /* Odd while snapshot_state is updated */
+    int stacking_index;         /* In the stacking order, -1 if not */
     xcb_shape_get_rectangles_reply_t *shape;
+    _xcwm_damage_stats dmg_stats;
+    unsigned long damage_interval; /* Microseconds between damage
+                                    * deliveries, 0 if not limited,
+                                    * locked */
+    int damage_interval_set;    /* 1 if set by the client, rather than
+                                 * by xcwm_window_get_capture_strategy */
+    uint64_t next_damage;       /* When damage may next be delivered */
+    int pending;                /* _XCWM_PENDING_* changes in this batch */
+    xcb_atom_t *pending_atoms;  /* Properties changed in this batch */
+    int num_pending_atoms;
+    int max_pending_atoms;
 };
 
-/**
- * Mutex lock supplied to client to lock event loop thread
- */
-extern pthread_mutex_t event_thread_lock;
-
-
 /* util.c */
 
 /**
@@ -144,6 +286,47 @@ _xcwm_write_all_children_window_info(xcb_connection_t *conn,
 void
 _xcwm_write_window_info(xcb_connection_t *conn, xcb_window_t window);
 
+/**
+ * Get the time on the monotonic clock.
+ * @return The time in microseconds.
+ */
+uint64_t
+_xcwm_time_us(void);
+
+/**
+ * Send the requests queued on the context to the server, unless a
+ * batch of requests is open.
+ * @param context The context to flush.
+ */
+void
+_xcwm_flush(xcwm_context_t *context);
+
+/**
+ * Note an unchecked request, so an error it causes can be traced back
+ * to the window and operation it was made for. Only the most recent
+ * _XCWM_TRACKED_REQUESTS requests are remembered.
+ * @param context The context the request was made on.
+ * @param cookie The cookie returned by the request.
+ * @param window The window the request was made for.
+ * @param resource The resource the request created or used.
+ * @param op The operation.
+ */
+void
+_xcwm_request_track(xcwm_context_t *context, xcb_void_cookie_t cookie,
+                    xcb_window_t window, uint32_t resource,
+                    xcwm_error_op_t op);
+
+/**
+ * Find the request an error was caused by.
+ * @param context The context the error was received on.
+ * @param error The error.
+ * @param[out] request The request, if found.
+ * @return 1 if the request was found, otherwise 0.
+ */
+int
+_xcwm_request_find(xcwm_context_t *context, xcb_generic_error_t const *error,
+                   _xcwm_tracked_request *request);
+
 /**
  * Check the request cookie and determine if there is an error.
  * @param conn The connection the request was sent on.
@@ -197,57 +380,330 @@ _xcwm_init_xfixes(xcwm_context_t *contxt);
 void
 _xcwm_init_shape(xcwm_context_t *contxt);
 
+/**
+ * Initialize the MIT-SHM extension, if available. Unlike the other
+ * extensions, it is not required.
+ * @param contxt The context
+ */
+void
+_xcwm_init_shm(xcwm_context_t *contxt);
+
+/****************
+* image.c
+****************/
+
+/**
+ * Pixels read from a window.
+ */
+typedef struct _xcwm_pixels {
+    uint8_t *data;
+    int stride;                 /* Bytes from one row to the next */
+    int bpp;                    /* Bits per pixel */
+    int depth;
+    xcb_image_t *image;         /* Holds the data if read over the socket */
+    xcwm_window_t *shm_window;  /* Window whose shared memory segment
+                                 * holds the data, if read through it */
+} _xcwm_pixels;
+
+/**
+ * Read an area of the window, through shared memory when possible.
+ * The data is valid until the next read from the window, and must be
+ * released with _xcwm_pixels_release().
+ * @param window The window
+ * @param x, y, width, height The area to read
+ * @param pixels Filled in with the pixels read
+ * @return 1 on success, 0 on failure.
+ */
+int
+_xcwm_image_read(xcwm_window_t *window, int x, int y, int width, int height,
+                 _xcwm_pixels *pixels);
+
+/**
+ * Release pixels read by _xcwm_image_read().
+ * @param pixels The pixels
+ */
+void
+_xcwm_pixels_release(_xcwm_pixels *pixels);
+
+/**
+ * Release the shared memory segment used to copy images of the window,
+ * if it has one, and stop using shared memory for it. If an image is
+ * being read through the segment, it is released once that is done.
+ * @param window The window
+ */
+void
+_xcwm_image_shm_release(xcwm_window_t *window);
+
+/****************
+* shadow.c
+****************/
+
+/* Number of dirty rectangles remembered for xcwm_shadow_get_dirty_rects */
+#define _XCWM_SHADOW_HISTORY 64
+
+/**
+ * Structure holding a window's shadow buffer
+ */
+typedef struct _xcwm_shadow {
+    xcwm_shadow_t pub;          /* What the client sees */
+    struct {
+        unsigned long generation;
+        xcwm_rect_t rect;
+    } history[_XCWM_SHADOW_HISTORY]; /* Rectangles updated, as a ring */
+    int history_next;
+    unsigned long history_floor; /* Generations up to this may have
+                                  * been dropped from the history */
+    _xcwm_region dirty;         /* Result of the last dirty query */
+    pthread_mutex_t lock;       /* Held while updating or querying */
+} _xcwm_shadow;
+
 /****************
 * event_loop.c
 ****************/
 
 /**
- * Stops the thread running the event loop.
- * @return 0 on success, otherwise zero.
+ * Stops the thread running the event loop, or removes the context from
+ * the shared event loop, and waits until it is no longer using the
+ * context.
+ * @param context The context whose event loop should be stopped.
+ * @return 0 on success, otherwise non-zero.
  */
 int
-_xcwm_event_stop_loop(void);
+_xcwm_event_stop_loop(xcwm_context_t *context);
+
+/**
+ * Adopt the windows already existing on the context and flush the
+ * connection. Called once on the event loop thread, before any events
+ * are processed.
+ * @param context The context.
+ */
+void
+_xcwm_event_loop_prepare(xcwm_context_t *context);
+
+/**
+ * Process events on the context's connection without blocking.
+ * @param context The context.
+ * If batching is enabled, the events processed form one batch.
+ * @param max_events The maximum number of events to process, or 0 to
+ * process all that are available.
+ * @param queued_only If non-zero, only process events already read
+ * from the connection, otherwise also read any waiting on the socket.
+ * @return The number of events processed, -1 if the connection has
+ * an error.
+ */
+int
+_xcwm_event_drain(xcwm_context_t *context, int max_events, int queued_only);
+
+/**
+ * Get how long the event loop may wait for events before damage held
+ * back by frame pacing is due.
+ * @param context The context.
+ * @return The timeout in milliseconds, or -1 if there is none.
+ */
+int
+_xcwm_event_timeout(xcwm_context_t *context);
 
 /****************
-* context_list.c
+* region.c
 ****************/
 
 /**
- * A structure (doubly linked list) to hold
- * pointers to the contexts
+ * Clip a rectangle to the area from 0, 0 of the given size.
+ * @param rect The rectangle, made empty if it lies outside the area.
+ * @param width The width of the area.
+ * @param height The height of the area.
+ * @return 1 if anything of the rectangle is left, otherwise 0.
+ */
+int
+_xcwm_rect_clip(xcwm_rect_t *rect, int width, int height);
+
+/**
+ * Initialize a region to be empty.
+ * @param region The region.
  */
-typedef struct _xcwm_window_node {
-    struct xcwm_window_t *window;   /**< Pointer to a window */
-    struct _xcwm_window_node * next; /**< Pointer to the next window node */
-    struct _xcwm_window_node * prev; /**< Pointer to the previous window node */
-} _xcwm_window_node;
+void
+_xcwm_region_init(_xcwm_region *region);
 
-/* this is the head pointer */
-extern _xcwm_window_node *_xcwm_window_list_head;
+/**
+ * Add a rectangle to a region. If the region has no room for another
+ * rectangle, rectangles are merged, so the region may grow to cover
+ * more than the exact union.
+ * @param region The region.
+ * @param rect The rectangle to add.
+ */
+void
+_xcwm_region_union_rect(_xcwm_region *region, xcwm_rect_t const *rect);
 
 /**
- * Add a newly created window to the context_list.
- * @param window The window to be added to the linked list
+ * Add a rectangle to a region, only if it can be held exactly.
+ * @param region The region.
+ * @param rect The rectangle to add.
+ * @return 1 if the rectangle was added, 0 if the region is full.
+ */
+int
+_xcwm_region_append_rect(_xcwm_region *region, xcwm_rect_t const *rect);
+
+/**
+ * Remove the area of a rectangle from a region.
+ * @param region The region.
+ * @param rect The rectangle to remove.
+ */
+void
+_xcwm_region_subtract_rect(_xcwm_region *region, xcwm_rect_t const *rect);
+
+/**
+ * Remove the area of one region from another.
+ * @param region The region to remove from.
+ * @param other The region to remove.
+ */
+void
+_xcwm_region_subtract(_xcwm_region *region, _xcwm_region const *other);
+
+/****************
+* reactor.c
+****************/
+
+/**
+ * Add a context to the shared event loop, starting the shared event
+ * loop thread if it is not already running.
+ * @param context The context to add.
+ * @return 0 on success, otherwise non-zero.
+ */
+int
+_xcwm_reactor_add(xcwm_context_t *context);
+
+/**
+ * Remove a context from the shared event loop. The thread exits once
+ * it no longer has any contexts to service.
+ * @param context The context to remove.
+ * @return 0 on success, otherwise non-zero.
+ */
+int
+_xcwm_reactor_remove(xcwm_context_t *context);
+
+/****************
+* event_ring.c
+****************/
+
+/**
+ * Add a record of an event to the context's event ring.
+ * @param context The context, which must have an event ring.
+ * @param window The window of the event, or NULL.
+ * @param event_type The type of the event.
+ */
+void
+_xcwm_event_ring_push(xcwm_context_t *context, xcwm_window_t *window,
+                      xcwm_event_type_t event_type);
+
+/**
+ * Free the context's event ring.
+ * @param context The context.
+ */
+void
+_xcwm_event_ring_release(xcwm_context_t *context);
+
+/****************
+* snapshot.c
+****************/
+
+/**
+ * Note that the state of the windows has changed, so a new snapshot is
+ * made at the next _xcwm_snapshot_publish(). May be called from any
+ * thread.
+ * @param context The context.
+ */
+void
+_xcwm_snapshot_changed(xcwm_context_t *context);
+
+/**
+ * Note that the state of a window shown in snapshots has changed, and
+ * update it. May be called from any thread, with the window locked or
+ * not.
+ * @param window The window.
+ * @param appearance 1 to also update its ID, type, override-redirect
+ * flag and opacity, which only the event loop thread may do.
+ */
+void
+_xcwm_snapshot_window_changed(xcwm_window_t *window, int appearance);
+
+/**
+ * Make a new snapshot if anything has changed since the last one, and
+ * make it the current snapshot. Called by the event loop thread once
+ * it has drained the events available.
+ * @param context The context.
+ */
+void
+_xcwm_snapshot_publish(xcwm_context_t *context);
+
+/**
+ * Free the current snapshot and the stacking order of the context.
+ * Snapshots the client still holds references to remain valid.
+ * @param context The context.
+ */
+void
+_xcwm_snapshot_release(xcwm_context_t *context);
+
+/**
+ * Add a new window to the top of the stacking order.
+ * @param window The window.
+ */
+void
+_xcwm_stacking_add(xcwm_window_t *window);
+
+/**
+ * Remove a window from the stacking order.
+ * @param window The window.
+ */
+void
+_xcwm_stacking_remove(xcwm_window_t *window);
+
+/**
+ * Move a window in the stacking order, as reported by ConfigureNotify.
+ * @param window The window.
+ * @param above_sibling The window it is now immediately above, or
+ * XCB_NONE if it is at the bottom.
+ */
+void
+_xcwm_stacking_restack(xcwm_window_t *window, xcb_window_t above_sibling);
+
+/****************
+* context_list.c
+****************/
+
+/**
+ * Add a newly created window to the window table.
+ * @param window The window to be added to the table
  * @return Pointer to window added to the list.
  */
 xcwm_window_t *
 _xcwm_add_window(xcwm_window_t *window);
 
 /**
- * Remove a window from the context_list using the window's id.
+ * Remove a window from the window table using the window's id.
+ * @param context The context the window is managed in.
  * @param window_id The window_id of the window which should
- * be removed from the context_list
+ * be removed from the window table
  */
 void
-_xcwm_remove_window_node(xcb_window_t window_id);
+_xcwm_remove_window_node(xcwm_context_t *context, xcb_window_t window_id);
 
 /**
- * Find a window in the doubly linked list using its window_id.
+ * Find a window in the window table using its window_id.
+ * @param context The context to search.
  * @param window_id The window_id of the window
  * @return Pointer to window (if found), NULL if not found.
  */
 xcwm_window_t *
-_xcwm_get_window_node_by_window_id(xcb_window_t window_id);
+_xcwm_get_window_node_by_window_id(xcwm_context_t *context,
+                                   xcb_window_t window_id);
+
+/**
+ * Release the memory used by the window table. The windows themselves
+ * are not freed.
+ * @param context The context to clear the window table of.
+ */
+void
+_xcwm_window_table_clear(xcwm_context_t *context);
 
 /****************
 * window.c
@@ -264,22 +720,74 @@ xcwm_window_t *
 _xcwm_window_create(xcwm_context_t *context, xcb_window_t new_window,
                     xcb_window_t parent);
 
+/**
+ * Requests sent to create a window, which are still to be collected
+ */
+typedef struct _xcwm_window_create_t {
+    xcwm_window_t *window;
+    xcb_window_t parent;
+    xcb_get_window_attributes_cookie_t attrs_cookie;
+    xcb_get_geometry_cookie_t geom_cookie;
+    xcb_shape_get_rectangles_cookie_t shape_rects_cookie;
+    struct _xcwm_atoms_request *atoms_request;
+} _xcwm_window_create_t;
+
+/**
+ * Start creating a new window, by sending all the requests needed
+ * without waiting for replies. Many windows can be started before
+ * any is finished, so creating them costs a single round trip.
+ * @param context The context the window was created in.
+ * @param new_window ID of the window being created.
+ * @param parent ID of the new window's parent.
+ * @param create Filled in with the requests sent.
+ * @return 1 if started, to be passed to _xcwm_window_create_finish(),
+ * 0 if the window already exists.
+ */
+int
+_xcwm_window_create_begin(xcwm_context_t *context, xcb_window_t new_window,
+                          xcb_window_t parent, _xcwm_window_create_t *create);
+
+/**
+ * Finish creating a window started by _xcwm_window_create_begin().
+ * @param create The requests sent.
+ * @return Pointer to new window. NULL if it is not a window we manage.
+ */
+xcwm_window_t *
+_xcwm_window_create_finish(_xcwm_window_create_t *create);
+
+/**
+ * Initialize the lock of a window.
+ * @param window The window.
+ */
+void
+_xcwm_window_lock_init(xcwm_window_t *window);
+
+/**
+ * Add a damage event to the damage statistics of a locked window.
+ * @param window The window.
+ * @param area The area damaged by the event.
+ * @param now The time, from _xcwm_time_us().
+ */
+void
+_xcwm_window_note_damage(xcwm_window_t *window, long area, uint64_t now);
+
 /**
  * Destroy the damage object associated with the window and
  * remove the window from the list of managed windows. Memory allocated
  * to the window must be removed with a call to _xcwm_window_release().
- * @param conn The connection to xserver
+ * @param context The context the window is managed in
  * @param window The window being removed
  * @return Pointer to the window that was removed from the list, NULL if
  * window isn't being managed
  */
 xcwm_window_t *
-_xcwm_window_remove(xcb_connection_t *conn,
+_xcwm_window_remove(xcwm_context_t *context,
                     xcb_window_t window);
 /**
- * Release the window and free its memory. Call after client has done
- * necessary clean up of the window on its side after the window has
- * been closed and a XCWM_DESTROY event has been received for the
+ * Release the context's reference to the window, freeing its memory
+ * unless the client still holds a reference. Call after client has
+ * done necessary clean up of the window on its side after the window
+ * has been closed and a XCWM_DESTROY event has been received for the
  * window.
  * @param window The window to release.
  */
@@ -287,8 +795,9 @@ void
 _xcwm_window_release(xcwm_window_t *window);
 
 /**
- * Resize the window to given x, y, width and height.
- * @param conn The connection
+ * Resize the window to given x, y, width and height. The request is
+ * only queued.
+ * @param context The context of the window
  * @param window The id of window to resize
  * @param x The new x position of window, relative to root.
  * @param y The new y position of window, relative to root.
@@ -296,7 +805,7 @@ _xcwm_window_release(xcwm_window_t *window);
  * @param height The new height
  */
 void
-_xcwm_resize_window(xcb_connection_t *conn, xcb_window_t window,
+_xcwm_resize_window(xcwm_context_t *context, xcb_window_t window,
                     int x, int y, int width, int height);
 
 /**
@@ -322,12 +831,62 @@ int
 _xcwm_atoms_init(xcwm_context_t *context);
 
 /**
- * Get and set the initial values ICCCM/EWMH atoms for the given
- * window.
- * @param window The window to get and set atoms values for.
+ * Requests sent for the initial values of a window's ICCCM/EWMH atoms
+ */
+struct _xcwm_atoms_request;
+
+/**
+ * Send the requests for the initial values of the ICCCM/EWMH atoms for
+ * the given window, without waiting for the replies.
+ * @param window The window to get atoms values for.
+ * @return The requests, to be passed to _xcwm_atoms_reply_window() or
+ * _xcwm_atoms_discard_window().
+ */
+struct _xcwm_atoms_request *
+_xcwm_atoms_request_window(xcwm_window_t *window);
+
+/**
+ * Collect the replies to _xcwm_atoms_request_window(), and set the
+ * values on the window.
+ * @param window The window to set atoms values for.
+ * @param request The requests, which are freed.
+ */
+void
+_xcwm_atoms_reply_window(xcwm_window_t *window,
+                         struct _xcwm_atoms_request *request);
+
+/**
+ * Send the requests for the new values of the properties of a window
+ * which have changed, without waiting for the replies. Each property
+ * is only requested once, however many times it is listed.
+ * @param window The window whose properties have changed.
+ * @param atoms The atoms of the properties which have changed.
+ * @param count The number of atoms.
+ * @return The requests, to be passed to _xcwm_atoms_reply_changes().
+ */
+struct _xcwm_atoms_request *
+_xcwm_atoms_request_changes(xcwm_window_t *window, const xcb_atom_t *atoms,
+                            int count);
+
+/**
+ * Collect the replies to _xcwm_atoms_request_changes(), and set the
+ * new values on the window.
+ * @param window The window whose properties have changed.
+ * @param request The requests, which are freed.
+ * @return A mask of (1 << event type) for each event to send.
+ */
+uint32_t
+_xcwm_atoms_reply_changes(xcwm_window_t *window,
+                          struct _xcwm_atoms_request *request);
+
+/**
+ * Discard the replies to _xcwm_atoms_request_window().
+ * @param context The context
+ * @param request The requests, which are freed.
  */
 void
-_xcwm_atoms_init_window(xcwm_window_t *window);
+_xcwm_atoms_discard_window(xcwm_context_t *context,
+                           struct _xcwm_atoms_request *request);
 
 /**
  * Set the WM_DELETE_WINDOW atom for the window.
@@ -336,6 +895,14 @@ _xcwm_atoms_init_window(xcwm_window_t *window);
 void
 _xcwm_atoms_set_wm_delete(xcwm_window_t *window);
 
+/**
+ * Free the property tables replaced by registering properties. Call
+ * from the event thread, between events.
+ * @param context The context.
+ */
+void
+_xcwm_atoms_reclaim(xcwm_context_t *context);
+
 /**
  * Clean up any atom data necessary.
  * @param context The context to clean up.
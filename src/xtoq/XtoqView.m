@@ -59,27 +59,30 @@
     xcwm_image_t *imageT;
     float y_transformed;
     XtoqImageRep *imageNew;
-    xcwm_rect_t *winRect;
-    xcwm_rect_t *dmgRect;
+    xcwm_rect_t winRect;
+    xcwm_rect_t dmgRect;
   
-    xcwm_event_get_thread_lock();
-    imageT = xcwm_image_copy_damaged(viewXcwmWindow);
+    // Take the areas with the window locked, but copy the image
+    // without, as that waits for the server
+    xcwm_window_lock(viewXcwmWindow);
+    winRect = *xcwm_window_get_full_rect(viewXcwmWindow);
+    dmgRect = *xcwm_window_get_damaged_rect(viewXcwmWindow);
+    xcwm_window_unlock(viewXcwmWindow);
+
+    imageT = xcwm_image_copy_area(viewXcwmWindow, &dmgRect);
     if (imageT) {
-        winRect = xcwm_window_get_full_rect(viewXcwmWindow);
-        dmgRect = xcwm_window_get_damaged_rect(viewXcwmWindow);
-        y_transformed = (winRect->height - dmgRect->y
-                         - dmgRect->height) / 1.0;
+        y_transformed = (winRect.height - dmgRect.y
+                         - dmgRect.height) / 1.0;
         imageNew = [[XtoqImageRep alloc]
                     initWithData: imageT
-                               x: dmgRect->x
+                               x: dmgRect.x
                                y: y_transformed];
         [imageNew draw];
         [imageNew destroy];
 
-        // Remove the damage
+        // Remove the damage copied, anything since is drawn next time
         xcwm_window_remove_damage(viewXcwmWindow);
     }
-    xcwm_event_release_thread_lock();
 }
 
 - (void)setPartialImage: (NSRect)newDamageRect